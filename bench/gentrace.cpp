@@ -0,0 +1,169 @@
+/*
+ * Trace generator
+ * Writes a binary trace (trace.h) for the drivers and for ycsb -L / -T.
+ * Without -m the trace only holds keys: the distinct keys of records 1..n in
+ * id order, which is uniform over the key space, or ascending with -d
+ * sorted. With -m it holds n operations in the given mix: inserts take new
+ * records after the first -k, and the other operations pick among those k
+ * records uniformly, by a zipfian rank or in ascending key order.
+ */
+#include "keygen.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#define GEN_CHUNK 65536
+
+enum gen_dist { GEN_UNIFORM, GEN_ZIPFIAN, GEN_SORTED };
+static const char *gen_dist_names[] = {"uniform", "zipfian", "sorted"};
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s -n count -o file [-d uniform|zipfian|sorted]\n"
+          "          [-k records] [-z theta] [-s seed]\n"
+          "          [-m insert,search,update,delete,scan percent]\n",
+          prog);
+  exit(1);
+}
+
+// the keys of records 1..n in ascending order
+static std::vector<int64_t> sorted_keys(long n) {
+  std::vector<int64_t> keys(n);
+  for (long i = 0; i < n; ++i)
+    keys[i] = key_of(i + 1);
+  std::sort(keys.begin(), keys.end());
+  return keys;
+}
+
+int main(int argc, char **argv) {
+  long count = 0, records = 0;
+  const char *out_path = NULL;
+  int dist = GEN_UNIFORM, mix[TRACE_NUM_OPS] = {0};
+  bool with_ops = false;
+  double theta = 0.99;
+  uint64_t seed = 1;
+  int c;
+
+  while ((c = getopt(argc, argv, "n:o:d:k:m:z:s:")) != -1) {
+    switch (c) {
+    case 'n':
+      count = atol(optarg);
+      break;
+    case 'o':
+      out_path = optarg;
+      break;
+    case 'd':
+      for (dist = 0; dist < 3; ++dist)
+        if (strcmp(optarg, gen_dist_names[dist]) == 0)
+          break;
+      if (dist == 3)
+        usage(argv[0]);
+      break;
+    case 'k':
+      records = atol(optarg);
+      break;
+    case 'm': {
+      int total = 0;
+      char *p = optarg;
+      for (int i = 0; i < TRACE_NUM_OPS && *p; ++i) {
+        mix[i] = strtol(p, &p, 10);
+        total += mix[i];
+        if (*p == ',')
+          ++p;
+      }
+      if (total != 100 || *p)
+        usage(argv[0]);
+      with_ops = true;
+      break;
+    }
+    case 'z':
+      theta = atof(optarg);
+      break;
+    case 's':
+      seed = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  if (count < 1 || out_path == NULL)
+    usage(argv[0]);
+  if (records == 0)
+    records = count;
+  if (!with_ops && dist == GEN_ZIPFIAN) {
+    fprintf(stderr, "a keys-only trace has distinct keys; zipfian needs -m\n");
+    exit(1);
+  }
+
+  FILE *f = fopen(out_path, "wb");
+  if (f == NULL) {
+    perror(out_path);
+    exit(1);
+  }
+
+  trace_header hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+  hdr.version = TRACE_VERSION;
+  hdr.flags = with_ops ? TRACE_HAS_OPS : 0;
+  hdr.count = count;
+  fwrite(&hdr, sizeof(hdr), 1, f);
+
+  std::vector<int64_t> keys(GEN_CHUNK);
+  std::vector<uint8_t> ops;
+  std::vector<int64_t> order;
+
+  if (!with_ops) {
+    if (dist == GEN_SORTED) {
+      order = sorted_keys(count);
+      fwrite(order.data(), sizeof(int64_t), count, f);
+    } else {
+      for (long i = 0; i < count; i += GEN_CHUNK) {
+        long n = std::min(count - i, (long)GEN_CHUNK);
+        for (long j = 0; j < n; ++j)
+          keys[j] = key_of(i + j + 1);
+        fwrite(keys.data(), sizeof(int64_t), n, f);
+      }
+    }
+  } else {
+    rng r(seed);
+    zipfian *zipf = dist == GEN_ZIPFIAN ? new zipfian(records, theta) : NULL;
+    uint64_t next_id = records + 1, sweep = 0;
+
+    if (dist == GEN_SORTED)
+      order = sorted_keys(records);
+    ops.resize(count);
+
+    for (long i = 0; i < count; i += GEN_CHUNK) {
+      long n = std::min(count - i, (long)GEN_CHUNK);
+      for (long j = 0; j < n; ++j) {
+        int op = 0;
+        for (int dice = r.next() % 100; dice >= mix[op]; ++op)
+          dice -= mix[op];
+        ops[i + j] = op;
+
+        if (op == TRACE_INSERT)
+          keys[j] = key_of(next_id++);
+        else if (dist == GEN_ZIPFIAN)
+          keys[j] = key_of(1 + zipf->next(r));
+        else if (dist == GEN_SORTED)
+          keys[j] = order[sweep++ % records];
+        else
+          keys[j] = key_of(1 + r.next() % records);
+      }
+      fwrite(keys.data(), sizeof(int64_t), n, f);
+    }
+    fwrite(ops.data(), 1, count, f);
+    delete zipf;
+  }
+
+  if (ferror(f) || fclose(f) != 0) {
+    perror(out_path);
+    exit(1);
+  }
+  return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * Key generators shared by ycsb and gentrace
+ * Records are numbered from 1 and key_of() spreads a record id over the
+ * positive keys, so the same id names the same key in a generated trace and
+ * in a ycsb run. A zipfian rank picks a record id, with rank 0 the hottest.
+ */
+#ifndef FAST_FAIR_KEYGEN_H
+#define FAST_FAIR_KEYGEN_H
+
+#include <math.h>
+#include <stdint.h>
+
+static inline int64_t key_of(uint64_t id) {
+  // an odd multiplier is a bijection modulo 2^63, so keys stay distinct
+  return (int64_t)((id * 0x9E3779B97F4A7C15ULL) & INT64_MAX);
+}
+
+// xorshift64*
+struct rng {
+  uint64_t s;
+
+  rng(uint64_t seed) : s(seed * 0x2545F4914F6CDD1DULL + 1) {}
+
+  uint64_t next() {
+    s ^= s >> 12;
+    s ^= s << 25;
+    s ^= s >> 27;
+    return s * 0x2545F4914F6CDD1DULL;
+  }
+
+  // uniform in [0, 1)
+  double uniform() { return (next() >> 11) * (1.0 / (1ULL << 53)); }
+};
+
+// Zipfian ranks in [0, items) after Gray et al., as in YCSB; rank 0 is the
+// most popular
+struct zipfian {
+  uint64_t items;
+  double theta, alpha, zetan, eta;
+
+  static double zeta(uint64_t n, double theta) {
+    double sum = 0;
+    for (uint64_t i = 1; i <= n; ++i)
+      sum += 1 / pow((double)i, theta);
+    return sum;
+  }
+
+  zipfian(uint64_t items, double theta) : items(items), theta(theta) {
+    double zeta2 = zeta(2, theta);
+
+    zetan = zeta(items, theta);
+    alpha = 1 / (1 - theta);
+    eta = (1 - pow(2.0 / items, 1 - theta)) / (1 - zeta2 / zetan);
+  }
+
+  uint64_t next(rng &r) const {
+    double u = r.uniform();
+    double uz = u * zetan;
+
+    if (uz < 1)
+      return 0;
+    if (uz < 1 + pow(0.5, theta))
+      return 1;
+
+    uint64_t rank = (uint64_t)(items * pow(eta * u - eta + 1, alpha));
+    return rank < items ? rank : items - 1;
+  }
+};
+
+#endif
@@ -0,0 +1,132 @@
+/*
+ * Binary workload traces
+ * A trace is a 64-byte header followed by count 8-byte keys and, if the
+ * header has TRACE_HAS_OPS, count one-byte operations. The file is mapped
+ * read-only and used in place: the key array is what the drivers index, and
+ * worker threads take disjoint slices of it without any copy. Traces are
+ * written by bench/gentrace and may hold replayed production operations.
+ *
+ * load_keys() also accepts the text format of sample_input.txt, one key per
+ * line, so the drivers take either kind of file with -i.
+ */
+#ifndef FAST_FAIR_TRACE_H
+#define FAST_FAIR_TRACE_H
+
+#include <fcntl.h>
+#include <fstream>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TRACE_MAGIC "FFTRACE"
+#define TRACE_VERSION 1
+#define TRACE_HAS_OPS 0x1
+
+enum trace_op {
+  TRACE_INSERT,
+  TRACE_SEARCH,
+  TRACE_UPDATE,
+  TRACE_DELETE,
+  TRACE_SCAN,
+  TRACE_NUM_OPS
+};
+
+struct trace_header {
+  char magic[8]; // TRACE_MAGIC with its NUL
+  uint32_t version;
+  uint32_t flags;
+  uint64_t count;
+  char reserved[40]; // keeps the keys cache line aligned
+};
+
+static_assert(sizeof(trace_header) == 64, "trace header must be 64 bytes");
+
+class trace {
+  void *map;
+  size_t map_len;
+
+public:
+  const int64_t *keys;
+  const uint8_t *ops; // NULL for a keys-only trace
+  long count;
+
+  trace() : map(NULL), map_len(0), keys(NULL), ops(NULL), count(0) {}
+
+  ~trace() {
+    if (map)
+      munmap(map, map_len);
+  }
+
+  // Map path if it is a trace. Returns false, leaving the trace empty, if the
+  // file cannot be opened, is not a trace or is shorter than its header says.
+  bool open(const char *path) {
+    struct stat st;
+    int fd = ::open(path, O_RDONLY);
+
+    if (fd < 0)
+      return false;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(trace_header)) {
+      close(fd);
+      return false;
+    }
+
+    // fault the file in now rather than during a timed phase
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE,
+                   fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+      return false;
+
+    const trace_header *hdr = (const trace_header *)p;
+    size_t need = sizeof(trace_header) + hdr->count * sizeof(int64_t);
+    if (hdr->flags & TRACE_HAS_OPS)
+      need += hdr->count;
+    if (memcmp(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != TRACE_VERSION || (size_t)st.st_size < need) {
+      munmap(p, st.st_size);
+      return false;
+    }
+
+    map = p;
+    map_len = st.st_size;
+    count = hdr->count;
+    keys = (const int64_t *)(hdr + 1);
+    ops = (hdr->flags & TRACE_HAS_OPS) ? (const uint8_t *)(keys + count)
+                                        : NULL;
+    return true;
+  }
+
+  // first record of slice i when the trace is cut into n slices
+  long slice_begin(int i, int n) const { return count * i / n; }
+};
+
+// Keys for a driver: a trace is mapped into t and used in place, and a text
+// file is parsed into a new array. Returns NULL if the file cannot be read.
+// *num is lowered to the number of keys the file holds.
+static int64_t *load_keys(const char *path, long *num, trace *t) {
+  if (t->open(path)) {
+    if (*num > t->count)
+      *num = t->count;
+    return (int64_t *)t->keys;
+  }
+
+  std::ifstream ifs(path);
+  if (!ifs)
+    return NULL;
+
+  int64_t *keys = new int64_t[*num];
+  long i = 0;
+  while (i < *num && ifs >> keys[i])
+    ++i;
+  *num = i;
+  return keys;
+}
+
+static void free_keys(int64_t *keys, trace *t) {
+  if (keys != t->keys)
+    delete[] keys;
+}
+
+#endif
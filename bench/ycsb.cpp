@@ -0,0 +1,556 @@
+/*
+ * YCSB-style benchmark
+ * Builds against the btree.h of any of the four variants: the Makefile of
+ * each variant puts its src/ on the include path and passes -DBENCH_PMDK for
+ * the PMDK trees and -DBENCH_SINGLE for the trees without locks, which then
+ * run with one thread. -DBENCH_SHARDED (make ycsb SHARDED=1 in the
+ * concurrent variants) runs against a sharded_btree of -K shards, split
+ * evenly over the key space or, with -H, by hash.
+ *
+ * Keys are hashed record ids (keygen.h), so the load and the inserts of the
+ * run land in random leaves while a zipfian id still names one hot key.
+ * Instead of a YCSB mix, -T replays the operations of a binary trace
+ * (trace.h) and -L loads the keys of one, each thread taking its own slice
+ * of the mapped file. Each operation is timed on its own and recorded in a
+ * per-thread log-linear histogram that is merged when the run is over.
+ */
+#include "btree.h"
+#include "keygen.h"
+#include "trace.h"
+
+#include <pthread.h>
+
+#define BENCH_MAX_THREADS 256
+#define HIST_SUB_BITS 5 // 32 sub-buckets per power of two, ~3% error
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+#if defined(BENCH_SHARDED) && defined(BENCH_PMDK)
+typedef sharded_btree tree_t;
+typedef sharded_cursor cursor_t;
+#elif defined(BENCH_SHARDED)
+typedef sharded_btree<> tree_t;
+typedef sharded_cursor<> cursor_t;
+#elif defined(BENCH_PMDK)
+typedef btree tree_t;
+typedef btree_cursor cursor_t;
+#else
+typedef btree<> tree_t;
+typedef btree_cursor<> cursor_t;
+#endif
+
+enum op_type {
+  OP_READ,
+  OP_UPDATE,
+  OP_INSERT,
+  OP_SCAN,
+  OP_RMW,
+  OP_DELETE, // replayed traces only
+  OP_NUM
+};
+static const char *op_names[OP_NUM] = {"read", "update", "insert",
+                                       "scan", "rmw",    "delete"};
+
+// op_type of each trace_op
+static const int trace_ops[TRACE_NUM_OPS] = {OP_INSERT, OP_READ, OP_UPDATE,
+                                             OP_DELETE, OP_SCAN};
+
+enum dist_type { DIST_UNIFORM, DIST_ZIPFIAN, DIST_LATEST };
+static const char *dist_names[] = {"uniform", "zipfian", "latest"};
+
+// Operation mix of a workload in percent, in op_type order
+struct workload {
+  char name;
+  int mix[OP_NUM];
+  int dist;
+};
+
+static const workload workloads[] = {
+    {'a', {50, 50, 0, 0, 0, 0}, DIST_ZIPFIAN},  // update heavy
+    {'b', {95, 5, 0, 0, 0, 0}, DIST_ZIPFIAN},   // read mostly
+    {'c', {100, 0, 0, 0, 0, 0}, DIST_ZIPFIAN},  // read only
+    {'d', {95, 0, 5, 0, 0, 0}, DIST_LATEST},    // read latest
+    {'e', {0, 0, 5, 95, 0, 0}, DIST_ZIPFIAN},   // short ranges
+    {'f', {50, 0, 0, 0, 50, 0}, DIST_ZIPFIAN}}; // read-modify-write
+
+// Latencies in ns in log-linear buckets: exact below HIST_SUB, then
+// HIST_SUB buckets for every power of two
+struct histogram {
+  uint64_t count, sum, max;
+  uint64_t buckets[HIST_BUCKETS];
+
+  histogram() : count(0), sum(0), max(0) {
+    memset(buckets, 0, sizeof(buckets));
+  }
+
+  static int bucket_of(uint64_t v) {
+    if (v < HIST_SUB)
+      return (int)v;
+    int msb = 63 - __builtin_clzll(v);
+    int shift = msb - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB + (int)((v >> shift) & (HIST_SUB - 1));
+  }
+
+  // the largest value that falls into bucket b
+  static uint64_t bucket_max(int b) {
+    if (b < HIST_SUB)
+      return b;
+    int shift = b / HIST_SUB - 1;
+    uint64_t sub = b % HIST_SUB;
+    return ((HIST_SUB + sub + 1) << shift) - 1;
+  }
+
+  void record(uint64_t ns) {
+    ++buckets[bucket_of(ns)];
+    ++count;
+    sum += ns;
+    if (ns > max)
+      max = ns;
+  }
+
+  void merge(const histogram &o) {
+    for (int i = 0; i < HIST_BUCKETS; ++i)
+      buckets[i] += o.buckets[i];
+    count += o.count;
+    sum += o.sum;
+    if (o.max > max)
+      max = o.max;
+  }
+
+  uint64_t percentile(double p) const {
+    uint64_t rank = (uint64_t)ceil(count * p / 100), seen = 0;
+
+    for (int i = 0; i < HIST_BUCKETS; ++i) {
+      seen += buckets[i];
+      if (seen >= rank && seen > 0)
+        return std::min(bucket_max(i), max);
+    }
+    return max;
+  }
+};
+
+struct alignas(CACHE_LINE_SIZE) insert_slot {
+  // a lower bound of the id this thread is inserting, UINT64_MAX when idle
+  std::atomic<uint64_t> pending;
+};
+
+tree_t *bt;
+const workload *wl = &workloads[0];
+int dist;
+double zipf_theta = 0.99;
+int max_scan = 100;
+int n_threads = 1;
+bool pin_threads = false;
+long num_records = 1000000;
+long num_ops = 0;
+long warmup_ops = 0;
+zipfian *zipf;
+trace load_trace, replay_trace; // empty unless -L / -T
+
+std::atomic<uint64_t> next_id;
+insert_slot insert_slots[BENCH_MAX_THREADS];
+std::atomic<int> ready;
+
+// The highest id below which every insert has finished. An inserting thread
+// publishes a bound of its id before it claims one, so an id that is read
+// here either has its insert done or is covered by a pending slot.
+static uint64_t readable_ids() {
+  uint64_t bound = next_id.load() - 1;
+
+  for (int i = 0; i < n_threads; ++i) {
+    uint64_t p = insert_slots[i].pending.load();
+    if (p <= bound)
+      bound = p - 1;
+  }
+  return bound;
+}
+
+static uint64_t choose_id(rng &r, uint64_t readable) {
+  switch (dist) {
+  case DIST_ZIPFIAN:
+    return 1 + zipf->next(r) % readable;
+  case DIST_LATEST: {
+    uint64_t back = zipf->next(r);
+    return back < readable ? readable - back : 1;
+  }
+  default:
+    return 1 + r.next() % readable;
+  }
+}
+
+static inline uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void pin(int tid) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(tid % std::thread::hardware_concurrency(), &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static void load(int tid, long from, long to) {
+  if (pin_threads)
+    pin(tid);
+  if (load_trace.count) {
+    for (long i = from; i < to; ++i)
+      bt->btree_insert(load_trace.keys[i], (char *)load_trace.keys[i]);
+    return;
+  }
+  for (long id = from; id < to; ++id)
+    bt->btree_insert(key_of(id), (char *)key_of(id));
+}
+
+struct worker {
+  int tid;
+  rng r;
+  uint64_t readable;
+  long pos; // next record of the replayed slice
+  entry_key_t *scan_keys;
+  char **scan_values;
+
+  worker(int tid, long pos)
+      : tid(tid), r(tid + 1), readable(readable_ids()), pos(pos),
+        scan_keys(new entry_key_t[max_scan]),
+        scan_values(new char *[max_scan]) {}
+
+  ~worker() {
+    delete[] scan_keys;
+    delete[] scan_values;
+  }
+
+  // the next operation of the workload mix and its key; inserts draw a new
+  // record id and publish it in the thread's slot
+  int choose(long i, entry_key_t *key) {
+    int op = 0;
+
+    for (int dice = r.next() % 100; dice >= wl->mix[op]; ++op)
+      dice -= wl->mix[op];
+    if (wl->mix[OP_INSERT] && (i & 63) == 0)
+      readable = readable_ids();
+
+    if (op == OP_INSERT) {
+      insert_slots[tid].pending.store(next_id.load());
+      *key = key_of(next_id.fetch_add(1));
+    } else {
+      *key = key_of(choose_id(r, readable));
+    }
+    return op;
+  }
+
+  // run the i-th operation of this thread and return its type
+  int step(long i) {
+    entry_key_t key;
+    int op;
+
+    if (replay_trace.count) {
+      // a keys-only trace replays as inserts
+      op = replay_trace.ops ? trace_ops[replay_trace.ops[pos]] : OP_INSERT;
+      key = replay_trace.keys[pos++];
+    } else {
+      op = choose(i, &key);
+    }
+
+    switch (op) {
+    case OP_READ:
+      bt->btree_search(key);
+      break;
+    case OP_UPDATE:
+      bt->btree_update(key, (char *)key);
+      break;
+    case OP_INSERT:
+      bt->btree_insert(key, (char *)key);
+      insert_slots[tid].pending.store(UINT64_MAX);
+      break;
+    case OP_DELETE:
+      bt->btree_delete(key);
+      break;
+    case OP_SCAN: {
+      int len = 1 + r.next() % max_scan, n;
+      cursor_t c(bt, key - 1, INT64_MAX, len);
+      while (len > 0 && (n = c.next(scan_keys, scan_values, len)) > 0)
+        len -= n;
+      break;
+    }
+    case OP_RMW:
+      bt->btree_search(key);
+      bt->btree_update(key, (char *)key);
+      break;
+    }
+    return op;
+  }
+};
+
+static void run(int tid, long pos, long warmup, long ops, histogram *hist) {
+  if (pin_threads)
+    pin(tid);
+
+  worker w(tid, pos);
+  long i = 0;
+
+  for (; i < warmup; ++i)
+    w.step(i);
+
+  // measure from the moment every thread is warm
+  ready.fetch_add(1);
+  while (ready.load() < n_threads)
+    sched_yield();
+
+  for (long end = i + ops; i < end; ++i) {
+    uint64_t start = now_ns();
+    int op = w.step(i);
+    hist[op].record(now_ns() - start);
+  }
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [-W a|b|c|d|e|f] [-n records] [-o ops] [-t threads]\n"
+          "          [-D uniform|zipfian|latest] [-z theta] [-s max scan]\n"
+          "          [-u warm-up ops per thread] [-a] [-L load trace]\n"
+          "          [-T replay trace]"
+#ifdef BENCH_SHARDED
+          " [-K shards] [-H]"
+#endif
+#ifdef BENCH_PMDK
+          " -p pool [-d]"
+#else
+          " [-w write ns] [-r read ns]"
+#endif
+          "\n",
+          prog);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  int c, dist_opt = -1;
+  const char *load_path = NULL, *replay_path = NULL;
+#ifdef BENCH_SHARDED
+  int num_shards = 4;
+  bool hashed = false;
+#endif
+#ifdef BENCH_PMDK
+  char *pool_path = NULL;
+  bool hybrid = false;
+#endif
+
+  while ((c = getopt(argc, argv, "W:n:o:t:D:z:s:u:aL:T:K:Hp:dw:r:")) != -1) {
+    switch (c) {
+    case 'W':
+      for (wl = workloads; wl->name != optarg[0]; ++wl)
+        if (wl == &workloads[5])
+          usage(argv[0]);
+      break;
+    case 'n':
+      num_records = atol(optarg);
+      break;
+    case 'o':
+      num_ops = atol(optarg);
+      break;
+    case 't':
+      n_threads = atoi(optarg);
+      break;
+    case 'D':
+      for (dist_opt = 0; dist_opt < 3; ++dist_opt)
+        if (strcmp(optarg, dist_names[dist_opt]) == 0)
+          break;
+      if (dist_opt == 3)
+        usage(argv[0]);
+      break;
+    case 'z':
+      zipf_theta = atof(optarg);
+      break;
+    case 's':
+      max_scan = atoi(optarg);
+      break;
+    case 'u':
+      warmup_ops = atol(optarg);
+      break;
+    case 'a':
+      pin_threads = true;
+      break;
+    case 'L':
+      load_path = optarg;
+      break;
+    case 'T':
+      replay_path = optarg;
+      break;
+#ifdef BENCH_SHARDED
+    case 'K':
+      num_shards = atoi(optarg);
+      break;
+    case 'H':
+      hashed = true;
+      break;
+#endif
+#ifdef BENCH_PMDK
+    case 'p':
+      pool_path = optarg;
+      break;
+    case 'd':
+      hybrid = true;
+      break;
+#else
+    case 'w':
+      persist_globals<>::write_latency_in_ns = atol(optarg);
+      break;
+    case 'r':
+      persist_globals<>::read_latency_in_ns = atol(optarg);
+      break;
+#endif
+    default:
+      usage(argv[0]);
+    }
+  }
+
+#ifdef BENCH_SINGLE
+  n_threads = 1;
+#endif
+  if (n_threads < 1 || n_threads > BENCH_MAX_THREADS || num_records < 1 ||
+      max_scan < 1)
+    usage(argv[0]);
+  if (load_path && !load_trace.open(load_path)) {
+    fprintf(stderr, "%s: not a trace\n", load_path);
+    exit(1);
+  }
+  if (replay_path && !replay_trace.open(replay_path)) {
+    fprintf(stderr, "%s: not a trace\n", replay_path);
+    exit(1);
+  }
+  if (load_trace.count)
+    num_records = load_trace.count;
+  if (replay_trace.count && (num_ops == 0 || num_ops > replay_trace.count))
+    num_ops = replay_trace.count;
+  if (num_ops == 0)
+    num_ops = num_records;
+  dist = dist_opt >= 0 ? dist_opt : wl->dist;
+
+#ifdef BENCH_SHARDED
+  // record keys are uniform over [0, INT64_MAX]
+  if (num_shards < 1)
+    usage(argv[0]);
+  std::vector<entry_key_t> splits;
+  for (int i = 1; i < num_shards; ++i)
+    splits.push_back(INT64_MAX / num_shards * i);
+#endif
+
+  bool loaded = false;
+#ifdef BENCH_PMDK
+  if (pool_path == NULL)
+    usage(argv[0]);
+
+  PMEMobjpool *pop;
+  if (access(pool_path, F_OK) != 0) {
+    if ((pop = pmemobj_create(pool_path, "btree", 8000000000, 0666)) == NULL) {
+      perror("pmemobj_create");
+      exit(1);
+    }
+    // the tree is the root object, whichever class it is
+    bt = (tree_t *)pmemobj_direct(pmemobj_root(pop, sizeof(tree_t)));
+#ifdef BENCH_SHARDED
+    bt->constructor(pop, num_shards, hashed ? NULL : splits.data(), hybrid);
+#else
+    bt->constructor(pop, hybrid);
+#endif
+  } else {
+    // an existing pool is taken to hold the records of an earlier load
+    if ((pop = pmemobj_open(pool_path, "btree")) == NULL) {
+      perror("pmemobj_open");
+      exit(1);
+    }
+    bt = (tree_t *)pmemobj_direct(pmemobj_root(pop, sizeof(tree_t)));
+    bt->open(pop, n_threads);
+    loaded = true;
+  }
+#elif defined(BENCH_SHARDED)
+  bt = hashed ? new tree_t(num_shards) : new tree_t(splits.data(), num_shards);
+#else
+  bt = new tree_t();
+#endif
+
+  if (replay_path)
+    printf("replay %s: %d threads, %ld records, %ld ops\n", replay_path,
+           n_threads, num_records, num_ops);
+  else
+    printf("YCSB-%c %s: %d threads, %ld records, %ld ops\n",
+           toupper(wl->name), dist_names[dist], n_threads, num_records,
+           num_ops);
+
+  if (!loaded) {
+    std::vector<std::thread> threads;
+    uint64_t start = now_ns();
+
+    // trace records are indexed from 0, record ids start at 1
+    long first = load_trace.count ? 0 : 1;
+    for (int t = 0; t < n_threads; ++t)
+      threads.push_back(
+          std::thread(load, t, first + num_records * t / n_threads,
+                      first + num_records * (t + 1) / n_threads));
+    for (auto &t : threads)
+      t.join();
+    printf("load: %.3f s\n", (now_ns() - start) / 1e9);
+  }
+
+  next_id.store(num_records + 1);
+  for (int t = 0; t < BENCH_MAX_THREADS; ++t)
+    insert_slots[t].pending.store(UINT64_MAX);
+  zipf = new zipfian(num_records, zipf_theta);
+
+  std::vector<histogram> hists(n_threads * OP_NUM);
+  std::vector<std::thread> threads;
+  btree_stats before = stats::snapshot();
+  uint64_t start = 0;
+  long measured = 0;
+
+  for (int t = 0; t < n_threads; ++t) {
+    long pos = num_ops * t / n_threads;
+    long ops = num_ops * (t + 1) / n_threads - pos, warmup = warmup_ops;
+
+    // a replayed slice is warmed up with its own first operations
+    if (replay_trace.count) {
+      warmup = std::min(warmup, ops);
+      ops -= warmup;
+    }
+    measured += ops;
+    threads.push_back(
+        std::thread(run, t, pos, warmup, ops, &hists[t * OP_NUM]));
+  }
+  while (ready.load() < n_threads)
+    sched_yield();
+  start = now_ns();
+  for (auto &t : threads)
+    t.join();
+
+  double elapsed = (now_ns() - start) / 1e9;
+  btree_stats d_stats = stats::snapshot() - before;
+
+  printf("run: %.3f s, %.3f Mops/s\n", elapsed, measured / elapsed / 1e6);
+  printf("%-8s %10s %10s %10s %10s %10s %10s\n", "op", "count", "mean(ns)",
+         "p50", "p99", "p999", "max");
+  for (int op = 0; op < OP_NUM; ++op) {
+    histogram h;
+    for (int t = 0; t < n_threads; ++t)
+      h.merge(hists[t * OP_NUM + op]);
+    if (h.count == 0)
+      continue;
+    printf("%-8s %10lu %10lu %10lu %10lu %10lu %10lu\n", op_names[op],
+           h.count, h.sum / h.count, h.percentile(50), h.percentile(99),
+           h.percentile(99.9), h.max);
+  }
+
+  printf("stats:");
+  for (int i = 0; i < STAT_NUM; ++i)
+    printf(" %s %llu", stats::name(i), d_stats[i]);
+  printf("\n");
+  // the load and the run together, empty unless built with TRACE=1
+  flush_trace::report(stdout);
+
+#ifdef BENCH_PMDK
+  pmemobj_close(pop);
+#else
+  delete bt;
+#endif
+  return 0;
+}
@@ -0,0 +1,3479 @@
+/*
+   Copyright (c) 2018, UNIST. All rights reserved.  The license is a free
+   non-exclusive, non-transferable license to reproduce, use, modify and display
+   the source code version of the Software, with or without modifications solely
+   for non-commercial research, educational or evaluation purposes. The license
+   does not entitle Licensee to technical support, telephone assistance,
+   enhancements or updates to the Software. All rights, title to and ownership
+   interest in the Software, including all intellectual property rights therein
+   shall remain in UNIST.
+
+   Please use at your own risk.
+*/
+
+/*
+ * FAST and FAIR core
+ * The one tree the four variants instantiate. Besides the key type, the
+ * value type and the page size, a tree takes two policies at compile time:
+ *
+ *   Lock     how pages are locked and unlinked pages are reclaimed, one of
+ *            no_locks, version_locks, mutex_locks or rw_locks (lock.h)
+ *   Persist  how pages link to each other, where they come from and how
+ *            they are written back: dram_persist or no_persist (dax.h) for
+ *            plain pointers, pmdk_persist (pmem.h) for pool offsets
+ *
+ * Every call into a policy is a static inline function, so what a policy
+ * turns off, such as the locks of no_locks or the flushes of no_persist,
+ * compiles to nothing. A tree with no_locks is the single-threaded one:
+ * btree_delete() merges and redistributes on the spot and a page is freed
+ * as soon as it is unlinked. With the other policies deletes only take the
+ * key out of its leaf and leave the merges to btree_compact().
+ *
+ * The records of an internal page hold its children as the words of
+ * Persist (Persist::word() and Persist::at()), and leaves hold the values
+ * as they are; linear_search() returns a word, which is a child, the right
+ * sibling or a value. The header links are Persist::link<page>.
+ *
+ * The policy headers come first: a variant includes this header, the one
+ * of its Persist policy and then names its instantiations.
+ */
+#ifndef FAST_FAIR_BTREE_H
+#define FAST_FAIR_BTREE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <climits>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <limits>
+#include <math.h>
+#include <mutex>
+#include <new>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <string.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#ifndef PAGESIZE
+#define PAGESIZE 512
+#endif
+
+#define DELAY_IN_NS (1000)
+#define CACHE_LINE_SIZE 64
+#define QUERY_NUM 25
+#define SCAN_PREFETCH_DEPTH 2
+#define MULTI_SEARCH_GROUP 16
+#define SHARD_SCAN_BATCH 16
+#define SHARD_MAX 64
+#define SCAN_RANGES_PER_THREAD 4
+#define SCAN_GUARD_LEAVES 64
+
+#define IS_FORWARD(c) (c % 2 == 0)
+
+using entry_key_t = int64_t;
+
+// modules shared by the four trees
+#include "util.h"
+#include "stats.h"
+#include "flush_trace.h"
+#include "simd.h"
+#include "numa.h"
+#include "slab.h"
+#include "ebr.h"
+#include "rtm.h"
+#include "lock.h"
+
+using namespace std;
+
+/*
+ * String keys
+ * string_key fits a string into the 8-byte key slot: the top 16 bits hold
+ * the first two bytes of the string in big-endian order and the low 48 bits
+ * hold a pointer to the NUL-terminated key bytes, which are owned by the
+ * caller and must stay valid and unchanged while the key is in the tree.
+ * Comparisons look at the inline prefix first and only dereference the key
+ * bytes when the prefixes tie, so most slots are rejected without touching
+ * another cache line. Keys that share a long common prefix (e.g. a URL
+ * scheme) tie on every slot and should be stored with that prefix stripped.
+ */
+class string_key {
+private:
+  uint64_t word;
+
+  static const uint64_t PTR_MASK = (1ULL << 48) - 1;
+
+  uint16_t prefix() const { return (uint16_t)(word >> 48); }
+  bool is_max() const { return word == ~0ULL; }
+
+  static int compare(const string_key &a, const string_key &b) {
+    if (a.word == b.word)
+      return 0;
+    if (a.prefix() != b.prefix())
+      return a.prefix() < b.prefix() ? -1 : 1;
+    if (a.is_max())
+      return 1;
+    if (b.is_max())
+      return -1;
+    if ((a.prefix() & 0xFF) == 0) // both strings end inside the prefix
+      return 0;
+    return strcmp(a.str() + 2, b.str() + 2);
+  }
+
+public:
+  string_key() : word(0) {}
+
+  string_key(const char *s) {
+    uint64_t p = 0;
+    if (s[0] != '\0')
+      p = ((uint64_t)(uint8_t)s[0] << 8) | (uint8_t)s[1];
+    word = (p << 48) | ((uint64_t)s & PTR_MASK);
+  }
+
+  static string_key max() {
+    string_key k;
+    k.word = ~0ULL;
+    return k;
+  }
+
+  const char *str() const {
+    return (word & PTR_MASK) ? (const char *)(word & PTR_MASK) : "";
+  }
+
+  // the encoded word, for the diagnostic printfs in the tree
+  explicit operator long() const { return (long)word; }
+  explicit operator unsigned long() const { return (unsigned long)word; }
+
+  bool operator==(const string_key &o) const { return compare(*this, o) == 0; }
+  bool operator!=(const string_key &o) const { return compare(*this, o) != 0; }
+  bool operator<(const string_key &o) const { return compare(*this, o) < 0; }
+  bool operator>(const string_key &o) const { return compare(*this, o) > 0; }
+  bool operator<=(const string_key &o) const { return compare(*this, o) <= 0; }
+  bool operator>=(const string_key &o) const { return compare(*this, o) >= 0; }
+};
+
+namespace std {
+template <> class numeric_limits<string_key> {
+public:
+  static const bool is_specialized = true;
+  static string_key max() { return string_key::max(); }
+};
+} // namespace std
+
+// a 64-bit hash of a key, for hash sharding and leaf fingerprints
+template <typename Key> inline uint64_t key_hash(const Key &key) {
+  return (uint64_t)key * 0x9E3779B97F4A7C15ULL;
+}
+
+// FNV-1a over the key bytes
+inline uint64_t key_hash(const string_key &key) {
+  uint64_t h = 0xCBF29CE484222325ULL;
+  for (const char *s = key.str(); *s; ++s)
+    h = (h ^ (uint8_t)*s) * 0x100000001B3ULL;
+  return h;
+}
+
+/*
+ * Leaf hints
+ * Keys that arrive nearly sorted go to the leaf the last one went to. Each
+ * thread remembers the leaf of its last insert and of its last search in
+ * each tree, and tries that leaf before descending from the root. An insert
+ * only takes the hinted leaf if, under its lock, the leaf's own keys span
+ * the new key or the leaf is the last one and the key is above its first
+ * key; a search only takes a key it finds there. A hint is only followed
+ * while the stamp of the Lock policy stays where it was taken: the epoch of
+ * a concurrent tree, in which a retired page is not freed before the epoch
+ * moves on twice, or the count of freed pages of a tree without locks. The
+ * epoch only moves while retired pages pile up, so a hint lasts through an
+ * ingest but never outlives its page. Hints live in DRAM, and a tree that
+ * is set up or opened again takes a new serial, which drops the hints
+ * taken before.
+ */
+struct leaf_hint {
+  uint64_t tree; // serial of the tree, 0 for none
+  uint64_t stamp;
+  void *leaf;
+};
+
+/*
+ * Compaction
+ * Deletes only take keys out of their leaf. btree_compact() walks the
+ * leaves and runs FAIR merge or redistribution on those under compact_fill
+ * of a full node, and start_compactor() keeps doing that on a background
+ * thread. The walk sleeps compact_pause_us each time it has checked another
+ * compact_batch leaves, and the background thread sleeps compact_idle_ms
+ * after a pass that found nothing to do.
+ */
+/*
+ * Unsorted leaves
+ * A tree set up while unsorted_leaves is on keeps the entries of its leaves
+ * in the order they came. The first meta_entries entries of such a leaf
+ * hold its slot map: a bitmap of the live slots, the leaf's lower fence,
+ * which its left sibling compares keys against as it would a first key,
+ * and a one-byte fingerprint of each slot's key. An insert writes a free
+ * slot and its fingerprint, flushes them and publishes the slot with one
+ * 8-byte store of the bitmap, so it writes back two or three lines wherever
+ * the key falls; a delete clears its bit. Entries are only sorted, on a
+ * copy, when the leaf splits or is rebalanced and when it is scanned. A
+ * freed slot can be written again under a reader, so readers of these
+ * leaves validate against the version lock instead of the switch_counter.
+ * Internal nodes stay FAST and FAIR.
+ */
+
+// the knobs above and the state that every tree shares, see util.h
+template <typename T = void> struct btree_globals {
+  static pthread_mutex_t print_mtx; // one print() at a time
+  static bool leaf_hints;
+  static std::atomic<uint64_t> tree_serial; // the serial of the last tree
+  static thread_local leaf_hint insert_hint, search_hint;
+  static double compact_fill;
+  static long compact_batch;
+  static unsigned long compact_pause_us;
+  static unsigned long compact_idle_ms;
+  static bool unsorted_leaves;
+};
+
+template <typename T>
+pthread_mutex_t btree_globals<T>::print_mtx = PTHREAD_MUTEX_INITIALIZER;
+template <typename T> bool btree_globals<T>::leaf_hints = true;
+template <typename T> std::atomic<uint64_t> btree_globals<T>::tree_serial(0);
+template <typename T> thread_local leaf_hint btree_globals<T>::insert_hint;
+template <typename T> thread_local leaf_hint btree_globals<T>::search_hint;
+template <typename T> double btree_globals<T>::compact_fill = 0.25;
+template <typename T> long btree_globals<T>::compact_batch = 64;
+template <typename T> unsigned long btree_globals<T>::compact_pause_us = 0;
+template <typename T> unsigned long btree_globals<T>::compact_idle_ms = 100;
+template <typename T> bool btree_globals<T>::unsorted_leaves = false;
+
+// slots left in an unsorted leaf of cardinality entries once meta of them
+// hold the slot map: at most 64, one bitmap bit each
+constexpr int unsorted_slots(int cardinality, int meta) {
+  return cardinality - meta < 64 ? cardinality - meta : 64;
+}
+
+// the fewest 16-byte entries that hold the bitmap, the fence and a
+// fingerprint per slot
+constexpr int unsorted_meta(int cardinality, int meta = 1) {
+  return 16 * meta >= 16 + unsorted_slots(cardinality, meta)
+             ? meta
+             : unsorted_meta(cardinality, meta + 1);
+}
+
+/*
+ * Parallel scan
+ * btree_parallel_scan() cuts (min, max) at the separator keys of the highest
+ * internal level that has SCAN_RANGES_PER_THREAD of them in range for each
+ * worker. The workers take the sub-ranges one at a time and walk their
+ * leaves down the sibling chain, and visit(worker, keys, values, n) gets the
+ * pairs of each leaf straight from its consistent copy, in ascending order
+ * within a sub-range. Calls on one worker never overlap, so per-worker state
+ * needs no lock. A pair that stays in the tree for the whole scan is seen
+ * exactly once. A worker drops its epoch guard every SCAN_GUARD_LEAVES
+ * leaves and finds its place again from the root, so a long scan does not
+ * hold back reclamation. btree_aggregate() folds the pairs into a
+ * scan_aggregate on the workers.
+ */
+template <typename Key = entry_key_t> struct scan_aggregate {
+  long count;
+  Key min_key, max_key; // set if count > 0
+  uint64_t sum;         // of the values taken as integers
+
+  scan_aggregate() : count(0), sum(0) {}
+
+  // add n pairs in ascending key order
+  template <typename Value> void add(const Key *keys, const Value *values,
+                                     int n) {
+    if (n <= 0)
+      return;
+    if (count == 0 || keys[0] < min_key)
+      min_key = keys[0];
+    if (count == 0 || keys[n - 1] > max_key)
+      max_key = keys[n - 1];
+    for (int i = 0; i < n; ++i)
+      sum += (uint64_t)values[i];
+    count += n;
+  }
+
+  void merge(const scan_aggregate &o) {
+    if (o.count == 0)
+      return;
+    if (count == 0 || o.min_key < min_key)
+      min_key = o.min_key;
+    if (count == 0 || o.max_key > max_key)
+      max_key = o.max_key;
+    sum += o.sum;
+    count += o.count;
+  }
+};
+
+/*
+ * The tree is a template on the key type, the value type, the page size
+ * and the Lock and Persist policies. Keys must be totally ordered and at
+ * most 8 bytes wide, and values must be pointer-sized because internal
+ * nodes keep child pointers in the same slot. NULL still terminates a node,
+ * so a value can never be zero.
+ */
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+class basic_page;
+
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+class basic_cursor;
+
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+class basic_sharded_btree;
+
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+class basic_btree {
+  typedef Key entry_key_t;
+  typedef basic_page<Key, Value, PageSize, Lock, Persist> page;
+  typedef typename Persist::template link<page> link;
+  typedef typename Persist::pool_type pool_type;
+  typedef btree_globals<> globals;
+
+private:
+  int height;
+  link root;
+  pool_type *pool;     // where the root is recorded, NULL for a DRAM tree
+  uint64_t serial;     // tells the trees apart in leaf hints
+  uint32_t generation; // of the lock words in a pool, see lock.h
+  uint8_t hybrid;      // internal pages in DRAM, see pmem.h
+  link head;           // leftmost leaf
+  std::thread *compactor;
+  std::atomic<bool> compactor_stop;
+  std::mutex compact_mtx;
+  int replica_levels; // top internal levels replicated per node, 0 for none
+  std::mutex replica_mtx; // serializes the updates of the replicas
+  std::atomic<numa_replica<Key> *> replicas[NUMA_MAX_NODES];
+
+  // the leaf of h if it was taken in this tree and stamp, else NULL
+  page *hinted(const leaf_hint &h) {
+    if (globals::leaf_hints && h.tree == serial && h.stamp == Lock::stamp())
+      return (page *)h.leaf;
+    return NULL;
+  }
+
+  void remember(leaf_hint &h, page *leaf) {
+    h.tree = serial;
+    h.stamp = Lock::stamp();
+    h.leaf = leaf;
+  }
+
+  // the page a descent to key starts from: the one the replica of this
+  // thread's node routes key to, or the root
+  page *top(entry_key_t key) {
+    numa_replica<Key> *r;
+
+    if (replica_levels == 0 ||
+        (r = replicas[numa_node()].load(std::memory_order_acquire)) == NULL)
+      return root;
+    return (page *)r->route(key);
+  }
+
+  // the DRAM state of a tree that lives in a pool, which a restart loses
+  void reset() {
+    compactor = NULL;
+    compactor_stop = false;
+    new (&compact_mtx) std::mutex;
+    new (&replica_mtx) std::mutex;
+    replica_levels = 0;
+    for (int i = 0; i < NUMA_MAX_NODES; ++i)
+      replicas[i] = NULL;
+  }
+
+  void build_levels(std::vector<page *> &, std::vector<entry_key_t> &, int,
+                    int);
+  void rebuild_inner(int);
+
+  void collect_replica(page *, page *, bool, entry_key_t, uint32_t,
+                       std::vector<entry_key_t> *, std::vector<void *> *);
+  void publish_replicas(uint32_t, const std::vector<entry_key_t> &,
+                        const std::vector<void *> &);
+  void rebuild_replicas();
+  void replica_insert(entry_key_t, page *, uint32_t);
+
+  page *find_leaf(entry_key_t);
+  void scan_bounds(entry_key_t, entry_key_t, long, std::vector<entry_key_t> *);
+  template <typename F>
+  void scan_range(entry_key_t, bool, entry_key_t, int, const F &);
+
+public:
+  basic_btree();
+  basic_btree(pool_type *);
+  ~basic_btree();
+  void constructor(pool_type *, bool hybrid = false);
+  void open(pool_type *, int num_threads = 1);
+  void setNewRoot(page *);
+  void getNumberOfNodes();
+  void btree_insert(entry_key_t, Value);
+  void btree_insert_batch(entry_key_t *, Value *, int);
+  void btree_bulk_load(entry_key_t *, Value *, long, double fill_factor = 1.0,
+                       int num_threads = 1);
+  void btree_insert_internal(char *, entry_key_t, char *, uint32_t);
+  void btree_delete(entry_key_t);
+  bool btree_update(entry_key_t, Value);
+  bool btree_upsert(entry_key_t, Value);
+  void btree_delete_internal(entry_key_t, char *, uint32_t, entry_key_t *,
+                             bool *, page **);
+  Value btree_search(entry_key_t);
+  void btree_multi_search(entry_key_t *, int, Value *);
+  void btree_search_range(entry_key_t, entry_key_t, unsigned long *);
+  template <typename F>
+  void btree_parallel_scan(entry_key_t, entry_key_t, const F &,
+                           int num_threads = 1);
+  scan_aggregate<Key> btree_aggregate(entry_key_t, entry_key_t,
+                                      int num_threads = 1);
+  long btree_compact();
+  void start_compactor();
+  void stop_compactor();
+  void start_reserver();
+  void stop_reserver();
+  void numa_replicate(int levels = NUMA_REPLICA_LEVELS);
+  void printAll();
+  void randScounter();
+
+  friend page;
+  friend class basic_cursor<Key, Value, PageSize, Lock, Persist>;
+  friend class basic_sharded_btree<Key, Value, PageSize, Lock, Persist>;
+};
+
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+class basic_header {
+  typedef basic_page<Key, Value, PageSize, Lock, Persist> page;
+  typedef typename Persist::template link<page> link;
+
+private:
+  link leftmost_ptr;              // 8 bytes
+  link sibling_ptr;               // 8 bytes
+  uint16_t level;                 // 2 bytes
+  uint8_t unsorted;               // 1 bytes
+  uint8_t switch_counter;         // 1 bytes
+  uint8_t is_deleted;             // 1 bytes
+  int16_t last_index;             // 2 bytes
+  typename Lock::page_lock vlock; // 8 bytes, 1 without locks
+
+  friend page;
+  friend class basic_btree<Key, Value, PageSize, Lock, Persist>;
+  friend class basic_cursor<Key, Value, PageSize, Lock, Persist>;
+
+public:
+  basic_header() {
+    leftmost_ptr = NULL;
+    sibling_ptr = NULL;
+    unsorted = 0;
+    switch_counter = 0;
+    last_index = -1;
+    is_deleted = false;
+  }
+};
+
+template <typename Key> class entry {
+private:
+  Key key;   // 8 bytes
+  char *ptr; // 8 bytes
+
+public:
+  entry() {
+    key = std::numeric_limits<Key>::max();
+    ptr = NULL;
+  }
+
+  template <typename, typename, int, typename, typename>
+  friend class basic_page;
+  template <typename, typename, int, typename, typename>
+  friend class basic_btree;
+};
+
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+class basic_page {
+  typedef Key entry_key_t;
+  typedef basic_page page;
+  typedef basic_btree<Key, Value, PageSize, Lock, Persist> btree;
+  typedef basic_header<Key, Value, PageSize, Lock, Persist> header;
+  typedef ::entry<Key> entry;
+
+public:
+  static constexpr int cardinality =
+      (PageSize - sizeof(header)) / sizeof(entry);
+  static constexpr int count_in_line = CACHE_LINE_SIZE / sizeof(entry);
+
+  // a parent insert that btree_insert_batch(), btree_upsert() or a hinted
+  // insert issues once the leaf lock is released
+  struct split_entry {
+    entry_key_t key;
+    page *sibling;
+    uint32_t level;
+  };
+
+  static constexpr int meta_entries = unsorted_meta(cardinality);
+  static constexpr int leaf_slots = unsorted_slots(cardinality, meta_entries);
+  static constexpr uint64_t all_slots =
+      leaf_slots == 64 ? ~0ULL : (1ULL << leaf_slots) - 1;
+
+  // the slot map in the first meta_entries entries of an unsorted leaf
+  struct slot_map {
+    uint64_t bitmap; // bit i is set while slot i holds a live entry
+    entry_key_t low; // no key of the leaf is below it
+    uint8_t fingerprint[leaf_slots];
+  };
+
+  // an entry of an unsorted leaf and the slot it is in
+  struct slot_entry {
+    entry_key_t key;
+    char *ptr;
+    int slot;
+  };
+
+  static_assert(sizeof(Key) <= 8, "keys wider than 8 bytes are not supported");
+  static_assert(sizeof(Value) == sizeof(char *),
+                "values must be pointer-sized");
+  static_assert(PageSize % CACHE_LINE_SIZE == 0 && cardinality >= 4,
+                "PageSize must be a multiple of the cache line size");
+  static_assert(sizeof(slot_map) <= meta_entries * sizeof(entry),
+                "the slot map must fit its entries");
+
+private:
+  header hdr;                 // header in persistent memory, 16 bytes
+  entry records[cardinality]; // slots in persistent memory, 16 bytes * n
+
+public:
+  friend btree;
+  friend class basic_cursor<Key, Value, PageSize, Lock, Persist>;
+
+  basic_page(uint32_t level = 0) {
+    hdr.level = level;
+    records[0].ptr = NULL;
+  }
+
+  // this is called when tree grows
+  basic_page(page *left, entry_key_t key, page *right, uint32_t level = 0) {
+    hdr.leftmost_ptr = left;
+    hdr.level = level;
+    records[0].key = key;
+    records[0].ptr = word(right);
+    records[1].ptr = NULL;
+
+    hdr.last_index = 0;
+
+    Persist::persist(hdr.level, this, sizeof(page));
+  }
+
+  // pages come from Persist and go back to it with destroy()
+  static page *create(uint32_t level = 0) {
+    return new (alloc(level)) page(level);
+  }
+
+  static page *create(page *left, entry_key_t key, page *right,
+                      uint32_t level) {
+    return new (alloc(level)) page(left, key, right, level);
+  }
+
+  static void *alloc(uint32_t level) {
+    return Persist::template alloc_page<sizeof(page)>(level);
+  }
+
+  static void destroy(page *p) {
+    uint32_t level = p->hdr.level;
+
+    p->hdr.vlock.destroy();
+    p->~page();
+    Persist::template free_page<sizeof(page)>(p, level);
+    Lock::released();
+  }
+
+  // frees a page that remove_rebalancing() retired
+  static void release(void *p) { destroy((page *)p); }
+
+  // the page a record or a header link holds as a word, and back
+  static page *child(const char *w) {
+    return Persist::template at<page>(w);
+  }
+  static char *word(const page *p) { return Persist::word(p); }
+
+  slot_map *map() { return (slot_map *)records; }
+  entry &slot(int i) { return records[meta_entries + i]; }
+
+  static uint8_t fingerprint(const entry_key_t &key) {
+    return (uint8_t)(key_hash(key) >> 56);
+  }
+
+  // turn this new, empty leaf into an unsorted one
+  void make_unsorted(entry_key_t low = entry_key_t()) {
+    hdr.unsorted = 1;
+    map()->bitmap = 0;
+    map()->low = low;
+  }
+
+  // the smallest key this node may hold, as its left sibling sees it
+  inline entry_key_t low_key() {
+    return hdr.unsorted ? map()->low : records[0].key;
+  }
+
+  // the most entries this node holds
+  inline int capacity() { return hdr.unsorted ? leaf_slots : cardinality - 1; }
+
+  // whether key belongs to a node right of this one
+  inline bool beyond(entry_key_t key) {
+    page *sibling = hdr.sibling_ptr;
+    return sibling && key >= sibling->low_key();
+  }
+
+  // Copy the live entries of this unsorted leaf into e in ascending key
+  // order and return how many there are. An entry that belongs to the
+  // sibling, left behind by a crash in the middle of a split, is not live.
+  // The caller holds the lock or validates the version.
+  int sorted_slots(slot_entry *e) {
+    uint64_t live = __atomic_load_n(&map()->bitmap, __ATOMIC_ACQUIRE);
+    page *sibling = hdr.sibling_ptr;
+    entry_key_t high = sibling ? sibling->low_key() : entry_key_t();
+    int n = 0;
+
+    for (; live; live &= live - 1) {
+      int i = __builtin_ctzll(live), j = n;
+      entry_key_t k = slot(i).key;
+
+      if (sibling && k >= high)
+        continue;
+      for (; j > 0 && k < e[j - 1].key; --j)
+        e[j] = e[j - 1];
+      e[j].key = k;
+      e[j].ptr = slot(i).ptr;
+      e[j].slot = i;
+      ++n;
+    }
+    return n;
+  }
+
+  // the bitmap of slots 0..n-1
+  static uint64_t first_slots(int n) {
+    return n == 64 ? ~0ULL : (1ULL << n) - 1;
+  }
+
+  static uint64_t slot_bits(const slot_entry *e, int n) {
+    uint64_t bits = 0;
+    for (int j = 0; j < n; ++j)
+      bits |= 1ULL << e[j].slot;
+    return bits;
+  }
+
+  // Write key and ptr to free slot i with its fingerprint and flush them.
+  // Nothing reads the slot until publish() sets its bit.
+  void put_slot(int i, entry_key_t key, char *ptr) {
+    slot(i).key = key;
+    slot(i).ptr = ptr;
+    map()->fingerprint[i] = fingerprint(key);
+    Persist::persist_flush(hdr.level, &slot(i), sizeof(entry));
+    Persist::persist_flush(hdr.level, &map()->fingerprint[i], 1);
+  }
+
+  // make bitmap the live slots with one 8-byte store, once the slots it
+  // adds are durable
+  void publish(uint64_t bitmap) {
+    Persist::persist_drain(hdr.level);
+    __atomic_store_n(&map()->bitmap, bitmap, __ATOMIC_RELEASE);
+    Persist::persist(hdr.level, &map()->bitmap, sizeof(uint64_t));
+  }
+
+  // Put the n entries of e into free slots of this unsorted leaf, which has
+  // room for them, and publish them together
+  void add_entries(const slot_entry *e, int n) {
+    slot_entry live[leaf_slots];
+    uint64_t bitmap = slot_bits(live, sorted_slots(live));
+
+    for (int j = 0; j < n; ++j) {
+      int i = __builtin_ctzll(~bitmap);
+      put_slot(i, e[j].key, e[j].ptr);
+      bitmap |= 1ULL << i;
+    }
+    publish(bitmap);
+  }
+
+  // Fill the slots of this new unsorted leaf, not yet linked, with the n
+  // entries of e; the caller flushes the page
+  void fill_slots(const slot_entry *e, int n) {
+    assert(n <= leaf_slots);
+    for (int j = 0; j < n && j < leaf_slots; ++j) {
+      slot(j).key = e[j].key;
+      slot(j).ptr = e[j].ptr;
+      map()->fingerprint[j] = fingerprint(e[j].key);
+    }
+    map()->bitmap = first_slots(n);
+  }
+
+  // linear_search() of an unsorted leaf
+  char *search_unsorted(entry_key_t key) {
+    slot_map *m = map();
+    uint8_t fp = fingerprint(key);
+
+    for (;;) {
+      uint64_t v = hdr.vlock.read_begin();
+      uint64_t live = __atomic_load_n(&m->bitmap, __ATOMIC_ACQUIRE);
+      bool hop = beyond(key);
+      char *ret = hop ? word(hdr.sibling_ptr) : NULL;
+
+      // a key at or above the fence may have a stale copy here
+      for (; live && !hop; live &= live - 1) {
+        int i = __builtin_ctzll(live);
+        if (m->fingerprint[i] == fp && slot(i).key == key) {
+          ret = slot(i).ptr;
+          break;
+        }
+      }
+
+      if (hdr.vlock.validate(v)) {
+        if (hop)
+          stats::add(STAT_SIBLING_HOP);
+        return ret;
+      }
+      stats::add(STAT_RETRY);
+    }
+  }
+
+  // store() of an unsorted leaf, which the caller has locked if with_lock
+  page *store_unsorted(btree *bt, entry_key_t key, char *right,
+                       bool with_lock, std::vector<split_entry> *deferred) {
+    if (beyond(key)) {
+      if (with_lock) {
+        hdr.vlock.unlock();
+      }
+      stats::add(STAT_SIBLING_HOP);
+      return hdr.sibling_ptr->store(bt, NULL, key, right, true, with_lock,
+                                    NULL, deferred);
+    }
+
+    slot_entry e[leaf_slots];
+    uint64_t bitmap = map()->bitmap;
+    int n = 0;
+
+    // slots a crash in the middle of a split left to the sibling are free
+    if (bitmap == all_slots && (n = sorted_slots(e)) < leaf_slots)
+      bitmap = slot_bits(e, n);
+
+    if (bitmap != all_slots) {
+      flush_site site(SITE_INSERT_KEY);
+      int i = __builtin_ctzll(~bitmap);
+
+      put_slot(i, key, right);
+      publish(bitmap | 1ULL << i);
+      stats::add(STAT_FAST);
+
+      if (with_lock) {
+        hdr.vlock.unlock();
+      }
+      return this;
+    }
+
+    // FAIR on a sorted copy: the upper half goes to a new sibling, which is
+    // linked before this leaf drops it with one bitmap store
+    flush_site site(SITE_SPLIT);
+    stats::add(STAT_FAIR);
+    int m = n / 2;
+    entry_key_t split_key = e[m].key;
+
+    page *sibling = page::create(hdr.level);
+    sibling->make_unsorted(split_key);
+    sibling->fill_slots(e + m, n - m);
+    sibling->hdr.sibling_ptr = hdr.sibling_ptr;
+    Persist::persist(hdr.level, sibling, sizeof(page));
+
+    hdr.sibling_ptr = sibling;
+    Persist::persist(hdr.level, &hdr, sizeof(hdr));
+    publish(slot_bits(e, m));
+
+    page *ret = key < split_key ? this : sibling;
+    uint64_t free = ~ret->map()->bitmap & all_slots;
+    int i = __builtin_ctzll(free);
+    ret->put_slot(i, key, right);
+    ret->publish(ret->map()->bitmap | 1ULL << i);
+
+    insert_split(bt, split_key, sibling, with_lock, deferred);
+    return ret;
+  }
+
+  // covers() of an unsorted leaf
+  bool covers_unsorted(entry_key_t key) {
+    slot_entry e[leaf_slots];
+    int n = sorted_slots(e);
+
+    if (n == 0 || key < e[0].key)
+      return false;
+    return hdr.sibling_ptr == NULL || key <= e[n - 1].key;
+  }
+
+  // scan_leaf() of an unsorted leaf
+  int scan_unsorted(entry_key_t min, entry_key_t max, entry_key_t *keys,
+                    char **values, bool *end, page **next) {
+    slot_entry e[leaf_slots];
+    int n;
+
+    Persist::emulate_read();
+
+    for (;;) {
+      uint64_t v = hdr.vlock.read_begin();
+      int total = sorted_slots(e);
+
+      n = 0;
+      *end = false;
+      for (int j = 0; j < total; ++j) {
+        if (e[j].key >= max) {
+          *end = true;
+          break;
+        }
+        // a key inserted twice holds two slots; the scan returns it once
+        if (e[j].key > (n > 0 ? keys[n - 1] : min)) {
+          keys[n] = e[j].key;
+          values[n++] = e[j].ptr;
+        }
+      }
+      *next = hdr.sibling_ptr;
+
+      if (hdr.vlock.validate(v))
+        return n;
+      stats::add(STAT_RETRY);
+    }
+  }
+
+  // true if a writer has shifted entries since previous was read, in which
+  // case the caller reads the node again
+  inline bool switch_counter_moved(uint8_t previous) {
+    if (previous == hdr.switch_counter)
+      return false;
+    stats::add(STAT_RETRY);
+    return true;
+  }
+
+  inline int count() {
+    if (hdr.unsorted) {
+      slot_entry e[leaf_slots];
+      return sorted_slots(e);
+    }
+
+    uint8_t previous_switch_counter;
+    int count = 0;
+    do {
+      previous_switch_counter = hdr.switch_counter;
+      count = hdr.last_index + 1;
+
+      while (count >= 0 && count < cardinality &&
+             records[count].ptr != NULL) {
+        if (IS_FORWARD(previous_switch_counter))
+          ++count;
+        else
+          --count;
+      }
+
+      if (count < 0) {
+        count = 0;
+        while (records[count].ptr != NULL) {
+          ++count;
+        }
+      }
+
+    } while (switch_counter_moved(previous_switch_counter));
+
+    return count;
+  }
+
+  inline bool remove_key(entry_key_t key) {
+    flush_site site(SITE_REMOVE_KEY);
+
+    if (hdr.unsorted) {
+      uint64_t bitmap = map()->bitmap;
+      for (uint64_t live = bitmap; live; live &= live - 1) {
+        int i = __builtin_ctzll(live);
+        if (slot(i).key == key) {
+          publish(bitmap & ~(1ULL << i));
+          return true;
+        }
+      }
+      return false;
+    }
+
+    // Set the switch_counter
+    if (IS_FORWARD(hdr.switch_counter))
+      ++hdr.switch_counter;
+
+    bool shift = false;
+    int i;
+    for (i = 0; records[i].ptr != NULL; ++i) {
+      if (!shift && records[i].key == key) {
+        records[i].ptr =
+            (i == 0) ? word(hdr.leftmost_ptr) : records[i - 1].ptr;
+        shift = true;
+      }
+
+      if (shift) {
+        compiler_barrier();
+        records[i].key = records[i + 1].key;
+        compiler_barrier();
+        records[i].ptr = records[i + 1].ptr;
+
+        // flush
+        uint64_t records_ptr = (uint64_t)(&records[i]);
+        int remainder = records_ptr % CACHE_LINE_SIZE;
+        bool do_flush =
+            (remainder == 0) ||
+            ((((int)(remainder + sizeof(entry)) / CACHE_LINE_SIZE) == 1) &&
+             ((remainder + sizeof(entry)) % CACHE_LINE_SIZE) != 0);
+        if (do_flush) {
+          Persist::persist(hdr.level, (char *)records_ptr, CACHE_LINE_SIZE);
+        }
+      }
+    }
+
+    if (shift) {
+      --hdr.last_index;
+    }
+    return shift;
+  }
+
+  bool remove(btree *bt, entry_key_t key, bool only_rebalance = false,
+              bool with_lock = true) {
+    // one thread at a time: merge or redistribute on the spot
+    if (!Lock::concurrent) {
+      remove_rebalancing(bt, key, only_rebalance, false);
+      return true;
+    }
+
+    hdr.vlock.lock();
+
+    // merged away by the compactor: the caller starts over from the root
+    // or split after the caller found it, moving the key to the sibling
+    if (hdr.is_deleted || beyond(key)) {
+      hdr.vlock.unlock();
+      return false;
+    }
+
+    // a key that is not in the tree is not retried
+    remove_key(key);
+
+    hdr.vlock.unlock();
+
+    return true;
+  }
+
+  // Replace the value of key with a single flushed 8-byte store; readers see
+  // the old or the new pointer and never a shifted node. Writers hold the
+  // lock, so the slot is found with a plain scan. Returns false if the leaf
+  // was merged away and the caller must start over from the root, and
+  // otherwise sets *found. A missing key is inserted if upsert is set, with
+  // the parent update of a split left in *deferred.
+  bool update(btree *bt, entry_key_t key, char *value, bool upsert,
+              bool *found, std::vector<split_entry> *deferred) {
+    flush_site site(SITE_UPDATE);
+
+    hdr.vlock.lock();
+    if (hdr.is_deleted) {
+      hdr.vlock.unlock();
+      return false;
+    }
+
+    if (beyond(key)) {
+      hdr.vlock.unlock();
+      stats::add(STAT_SIBLING_HOP);
+      return hdr.sibling_ptr->update(bt, key, value, upsert, found, deferred);
+    }
+
+    *found = false;
+    if (hdr.unsorted) {
+      for (uint64_t live = map()->bitmap; live; live &= live - 1) {
+        int i = __builtin_ctzll(live);
+        if (slot(i).key == key) {
+          __atomic_store_n(&slot(i).ptr, value, __ATOMIC_RELEASE);
+          Persist::persist(hdr.level, &slot(i).ptr, sizeof(char *));
+          *found = true;
+          break;
+        }
+      }
+    }
+    for (int i = 0; !hdr.unsorted && records[i].ptr != NULL; ++i) {
+      if (records[i].key == key) {
+        __atomic_store_n(&records[i].ptr, value, __ATOMIC_RELEASE);
+        Persist::persist(hdr.level, &records[i].ptr, sizeof(char *));
+        *found = true;
+        break;
+      }
+    }
+
+    // the lock is held, so no other writer can insert the key meanwhile
+    if (!*found && upsert) {
+      store(bt, NULL, key, value, true, false, NULL, deferred);
+    }
+
+    hdr.vlock.unlock();
+    return true;
+  }
+
+  /*
+   * Although we implemented the rebalancing of B+-Tree, it is currently blocked
+   * for the performance. Please refer to the follow. Chi, P., Lee, W. C., &
+   * Xie, Y. (2014, August). Making B+-tree efficient in PCM-based main memory.
+   * In Proceedings of the 2014 international symposium on Low power electronics
+   * and design (pp. 69-74). ACM.
+   *
+   * btree_compact() runs it off the critical path instead, with
+   * only_rebalance set.
+   */
+  bool remove_rebalancing(btree *bt, entry_key_t key,
+                          bool only_rebalance = false, bool with_lock = true) {
+    flush_site site(SITE_MERGE);
+
+    if (with_lock) {
+      hdr.vlock.lock();
+    }
+    if (hdr.is_deleted) {
+      if (with_lock) {
+        hdr.vlock.unlock();
+      }
+      return false;
+    }
+
+    if (!only_rebalance) {
+      register int num_entries_before = count();
+
+      // This node is root
+      if (this == (page *)bt->root) {
+        if (hdr.level > 0) {
+          if (num_entries_before == 1 && !hdr.sibling_ptr) {
+            Persist::set_root(bt->pool, bt->root, (page *)hdr.leftmost_ptr,
+                              hdr.level - 1);
+
+            hdr.is_deleted = 1;
+          }
+        }
+
+        // Remove the key from this node
+        bool ret = remove_key(key);
+
+        if (with_lock) {
+          hdr.vlock.unlock();
+        }
+        if (hdr.is_deleted)
+          Lock::retire(this, release);
+        return true;
+      }
+
+      bool should_rebalance = true;
+      // check the node utilization
+      if (num_entries_before - 1 >= (int)(capacity() * 0.5)) {
+        should_rebalance = false;
+      }
+
+      // Remove the key from this node
+      bool ret = remove_key(key);
+
+      if (!should_rebalance) {
+        if (with_lock) {
+          hdr.vlock.unlock();
+        }
+        return (hdr.leftmost_ptr == NULL) ? ret : true;
+      }
+    }
+
+    // Remove a key from the parent node
+    entry_key_t deleted_key_from_parent = entry_key_t();
+    bool is_leftmost_node = false;
+    page *left_sibling = NULL;
+    bt->btree_delete_internal(key, word(this), hdr.level + 1,
+                              &deleted_key_from_parent, &is_leftmost_node,
+                              &left_sibling);
+
+    if (is_leftmost_node) {
+      page *sibling = hdr.sibling_ptr;
+      bool ret = false;
+
+      if (with_lock) {
+        hdr.vlock.unlock();
+      }
+      if (sibling == NULL) {
+        return false;
+      }
+
+      // rebalance the right sibling against this node instead
+      if (!with_lock) {
+        sibling->hdr.vlock.lock();
+      }
+      ret = sibling->remove_rebalancing(bt, key, true, with_lock);
+      if (!with_lock) {
+        sibling->hdr.vlock.unlock();
+      }
+      return ret;
+    }
+
+    // key led to a parent that no longer points here (the node moved
+    // under a racing split), so nothing was unlinked
+    if (left_sibling == NULL) {
+      if (with_lock) {
+        hdr.vlock.unlock();
+      }
+      return false;
+    }
+
+    if (with_lock) {
+      left_sibling->hdr.vlock.lock();
+    }
+
+    while (left_sibling->hdr.sibling_ptr != this) {
+      if (with_lock) {
+        page *t = left_sibling->hdr.sibling_ptr;
+        left_sibling->hdr.vlock.unlock();
+        left_sibling = t;
+        left_sibling->hdr.vlock.lock();
+      } else
+        left_sibling = left_sibling->hdr.sibling_ptr;
+    }
+
+    register int num_entries = count();
+    register int left_num_entries = left_sibling->count();
+
+    // Merge or Redistribution
+    int total_num_entries = num_entries + left_num_entries;
+    if (hdr.leftmost_ptr)
+      ++total_num_entries;
+
+    entry_key_t parent_key;
+
+    if (total_num_entries > capacity()) { // Redistribution
+      register int m = (int)ceil(total_num_entries / 2);
+
+      if (num_entries < left_num_entries) { // left -> right
+        if (hdr.unsorted) {
+          slot_entry ls[leaf_slots];
+          left_sibling->sorted_slots(ls);
+          add_entries(ls + m, left_num_entries - m);
+
+          // the new fence drops the moved keys from the left sibling,
+          // which then frees their slots
+          parent_key = ls[m].key;
+          map()->low = parent_key;
+          Persist::persist(hdr.level, &map()->low, sizeof(entry_key_t));
+          left_sibling->publish(slot_bits(ls, m));
+        } else if (hdr.leftmost_ptr == nullptr) {
+          for (int i = left_num_entries - 1; i >= m; i--) {
+            insert_key(left_sibling->records[i].key,
+                       left_sibling->records[i].ptr, &num_entries);
+          }
+
+          left_sibling->records[m].ptr = nullptr;
+          Persist::persist_flush(hdr.level, &(left_sibling->records[m].ptr),
+                          sizeof(char *));
+
+          left_sibling->hdr.last_index = m - 1;
+          Persist::persist_flush(hdr.level, &(left_sibling->hdr.last_index),
+                          sizeof(int16_t));
+          Persist::persist_drain(hdr.level);
+
+          parent_key = records[0].key;
+        } else {
+          insert_key(deleted_key_from_parent, word(hdr.leftmost_ptr),
+                     &num_entries);
+
+          for (int i = left_num_entries - 1; i > m; i--) {
+            insert_key(left_sibling->records[i].key,
+                       left_sibling->records[i].ptr, &num_entries);
+          }
+
+          parent_key = left_sibling->records[m].key;
+
+          hdr.leftmost_ptr = child(left_sibling->records[m].ptr);
+          Persist::persist(hdr.level, &(hdr.leftmost_ptr), sizeof(page *));
+
+          left_sibling->records[m].ptr = nullptr;
+          Persist::persist_flush(hdr.level, &(left_sibling->records[m].ptr),
+                          sizeof(char *));
+
+          left_sibling->hdr.last_index = m - 1;
+          Persist::persist_flush(hdr.level, &(left_sibling->hdr.last_index),
+                          sizeof(int16_t));
+          Persist::persist_drain(hdr.level);
+        }
+
+        if (left_sibling == ((page *)bt->root)) {
+          page *new_root =
+              page::create(left_sibling, parent_key, this, hdr.level + 1);
+          bt->setNewRoot(new_root);
+        } else {
+          bt->btree_insert_internal(word(left_sibling), parent_key,
+                                    word(this), hdr.level + 1);
+        }
+      } else { // from leftmost case
+        hdr.is_deleted = 1;
+        Persist::persist(hdr.level, &(hdr.is_deleted), sizeof(uint8_t));
+
+        page *new_sibling = page::create(hdr.level);
+        new_sibling->hdr.vlock.lock();
+        new_sibling->hdr.sibling_ptr = hdr.sibling_ptr;
+
+        int num_dist_entries = num_entries - m;
+        int new_sibling_cnt = 0;
+
+        if (hdr.unsorted) {
+          // the left sibling's new keys are above its fence until it is
+          // linked to new_sibling
+          slot_entry ts[leaf_slots];
+          sorted_slots(ts);
+          left_sibling->add_entries(ts, num_dist_entries);
+
+          parent_key = ts[num_dist_entries].key;
+          new_sibling->make_unsorted(parent_key);
+          new_sibling->fill_slots(ts + num_dist_entries, m);
+          Persist::persist(hdr.level, (new_sibling), sizeof(page));
+
+          left_sibling->hdr.sibling_ptr = new_sibling;
+          Persist::persist(hdr.level, &(left_sibling->hdr.sibling_ptr),
+                           sizeof(page *));
+        } else if (hdr.leftmost_ptr == nullptr) {
+          for (int i = 0; i < num_dist_entries; i++) {
+            left_sibling->insert_key(records[i].key, records[i].ptr,
+                                     &left_num_entries);
+          }
+
+          for (int i = num_dist_entries; records[i].ptr != NULL; i++) {
+            new_sibling->insert_key(records[i].key, records[i].ptr,
+                                    &new_sibling_cnt, false);
+          }
+
+          Persist::persist(hdr.level, (new_sibling), sizeof(page));
+
+          left_sibling->hdr.sibling_ptr = new_sibling;
+          Persist::persist(hdr.level, &(left_sibling->hdr.sibling_ptr),
+                           sizeof(page *));
+
+          parent_key = new_sibling->records[0].key;
+        } else {
+          left_sibling->insert_key(deleted_key_from_parent,
+                                   word(hdr.leftmost_ptr), &left_num_entries);
+
+          for (int i = 0; i < num_dist_entries - 1; i++) {
+            left_sibling->insert_key(records[i].key, records[i].ptr,
+                                     &left_num_entries);
+          }
+
+          parent_key = records[num_dist_entries - 1].key;
+
+          new_sibling->hdr.leftmost_ptr =
+              child(records[num_dist_entries - 1].ptr);
+          for (int i = num_dist_entries; records[i].ptr != NULL; i++) {
+            new_sibling->insert_key(records[i].key, records[i].ptr,
+                                    &new_sibling_cnt, false);
+          }
+          Persist::persist(hdr.level, (new_sibling), sizeof(page));
+
+          left_sibling->hdr.sibling_ptr = new_sibling;
+          Persist::persist(hdr.level, &(left_sibling->hdr.sibling_ptr),
+                           sizeof(page *));
+        }
+
+        if (left_sibling == ((page *)bt->root)) {
+          page *new_root = page::create(left_sibling, parent_key, new_sibling,
+                                        hdr.level + 1);
+          bt->setNewRoot(new_root);
+        } else {
+          bt->btree_insert_internal(word(left_sibling), parent_key,
+                                    word(new_sibling), hdr.level + 1);
+        }
+
+        new_sibling->hdr.vlock.unlock();
+      }
+    } else {
+      hdr.is_deleted = 1;
+      Persist::persist(hdr.level, &(hdr.is_deleted), sizeof(uint8_t));
+
+      if (hdr.leftmost_ptr)
+        left_sibling->insert_key(deleted_key_from_parent,
+                                 word(hdr.leftmost_ptr), &left_num_entries);
+
+      if (hdr.unsorted) {
+        slot_entry ts[leaf_slots];
+        left_sibling->add_entries(ts, sorted_slots(ts));
+      }
+      for (int i = 0; !hdr.unsorted && records[i].ptr != NULL; ++i) {
+        left_sibling->insert_key(records[i].key, records[i].ptr,
+                                 &left_num_entries);
+      }
+
+      left_sibling->hdr.sibling_ptr = hdr.sibling_ptr;
+      Persist::persist(hdr.level, &(left_sibling->hdr.sibling_ptr),
+                       sizeof(page *));
+    }
+
+    if (with_lock) {
+      left_sibling->hdr.vlock.unlock();
+      hdr.vlock.unlock();
+    }
+
+    // unlinked from its parent and its left sibling above
+    if (hdr.is_deleted)
+      Lock::retire(this, release);
+
+    return true;
+  }
+
+  inline void insert_key(entry_key_t key, char *ptr, int *num_entries,
+                         bool flush = true, bool update_last_index = true) {
+    flush_site site(SITE_INSERT_KEY);
+
+    // update switch_counter
+    if (!IS_FORWARD(hdr.switch_counter))
+      ++hdr.switch_counter;
+
+    // FAST
+    if (*num_entries == 0) { // this page is empty
+      entry *new_entry = (entry *)&records[0];
+      entry *array_end = (entry *)&records[1];
+      new_entry->key = (entry_key_t)key;
+      new_entry->ptr = (char *)ptr;
+
+      array_end->ptr = (char *)NULL;
+
+      if (flush) {
+        Persist::persist(hdr.level, this, CACHE_LINE_SIZE);
+      }
+    } else {
+      int i = *num_entries - 1, inserted = 0, to_flush_cnt = 0;
+      records[*num_entries + 1].ptr = records[*num_entries].ptr;
+      if (flush) {
+        if ((uint64_t) & (records[*num_entries + 1].ptr) % CACHE_LINE_SIZE == 0)
+          Persist::persist(hdr.level, &(records[*num_entries + 1].ptr),
+                           sizeof(char *));
+      }
+
+      // FAST
+      for (i = *num_entries - 1; i >= 0; i--) {
+        if (key < records[i].key) {
+          records[i + 1].ptr = records[i].ptr;
+          compiler_barrier();
+          records[i + 1].key = records[i].key;
+
+          if (flush) {
+            uint64_t records_ptr = (uint64_t)(&records[i + 1]);
+
+            int remainder = records_ptr % CACHE_LINE_SIZE;
+            bool do_flush =
+                (remainder == 0) ||
+                ((((int)(remainder + sizeof(entry)) / CACHE_LINE_SIZE) == 1) &&
+                 ((remainder + sizeof(entry)) % CACHE_LINE_SIZE) != 0);
+            if (do_flush) {
+              Persist::persist(hdr.level, (char *)records_ptr, CACHE_LINE_SIZE);
+              to_flush_cnt = 0;
+            } else
+              ++to_flush_cnt;
+          }
+        } else {
+          // the duplicated pointer hides the slot from readers while its
+          // key changes, so the compiler must not drop it as a dead store
+          records[i + 1].ptr = records[i].ptr;
+          compiler_barrier();
+          records[i + 1].key = key;
+          compiler_barrier();
+          records[i + 1].ptr = ptr;
+
+          if (flush)
+            Persist::persist(hdr.level, &records[i + 1], sizeof(entry));
+          inserted = 1;
+          break;
+        }
+      }
+      if (inserted == 0) {
+        records[0].ptr = word(hdr.leftmost_ptr);
+        compiler_barrier();
+        records[0].key = key;
+        compiler_barrier();
+        records[0].ptr = ptr;
+        if (flush)
+          Persist::persist(hdr.level, &records[0], sizeof(entry));
+      }
+    }
+
+    if (update_last_index) {
+      hdr.last_index = *num_entries;
+    }
+    ++(*num_entries);
+  }
+
+#ifdef RTM_ELISION
+  // FAST insert of key without taking the lock, see "Lock elision" in
+  // rtm.h; false if the caller has to take the lock. A hinted insert also
+  // needs the leaf to cover key.
+  bool store_elided(entry_key_t key, char *right, bool hinted = false) {
+    for (int attempt = 0; attempt < RTM_RETRIES; ++attempt) {
+      int num_entries, pos;
+      unsigned int status = _xbegin();
+
+      if (status == _XBEGIN_STARTED) {
+        if (hdr.vlock.is_locked())
+          _xabort(RTM_ABORT_LOCKED);
+        if (hdr.is_deleted || hdr.unsorted || (hinted && !covers(key)) ||
+            (hdr.sibling_ptr && key > hdr.sibling_ptr->records[0].key))
+          _xabort(RTM_ABORT_PATH);
+        num_entries = count();
+        if (num_entries >= cardinality - 1)
+          _xabort(RTM_ABORT_PATH);
+
+        // insert_key() shifts [pos, num_entries] one slot to the right
+        for (pos = num_entries; pos > 0 && key < records[pos - 1].key; --pos)
+          ;
+        if ((uint64_t)&records[pos] / CACHE_LINE_SIZE !=
+            (uint64_t)&records[num_entries + 1].ptr / CACHE_LINE_SIZE)
+          _xabort(RTM_ABORT_PATH);
+
+        insert_key(key, right, &num_entries, false);
+        _xend();
+
+        Persist::persist(hdr.level, &records[pos],
+                         (num_entries + 1 - pos) * sizeof(entry));
+        stats::add(STAT_FAST);
+        stats::add(STAT_RTM_COMMIT);
+        return true;
+      }
+
+      if (!(status & _XABORT_EXPLICIT) ||
+          _XABORT_CODE(status) == RTM_ABORT_LOCKED)
+        stats::add(STAT_RTM_ABORT);
+      if (!rtm_retry(status))
+        break;
+      while (hdr.vlock.is_locked())
+        cpu_pause();
+    }
+    stats::add(STAT_RTM_FALLBACK);
+    return false;
+  }
+#endif
+
+  // Insert a new key - FAST and FAIR
+  page *store(btree *bt, char *left, entry_key_t key, char *right, bool flush,
+              bool with_lock, page *invalid_sibling = NULL,
+              std::vector<split_entry> *deferred = NULL) {
+#ifdef RTM_ELISION
+    if (with_lock && flush && rtm_globals<>::lock_elision &&
+        store_elided(key, right))
+      return this;
+#endif
+    if (with_lock) {
+      hdr.vlock.lock(); // Lock the write lock
+    }
+    if (hdr.is_deleted) {
+      if (with_lock) {
+        hdr.vlock.unlock();
+      }
+
+      return NULL;
+    }
+    if (hdr.unsorted) {
+      return store_unsorted(bt, key, right, with_lock, deferred);
+    }
+
+    // If this node has a sibling node,
+    if (hdr.sibling_ptr && (hdr.sibling_ptr != invalid_sibling)) {
+      // Compare this key with the first key of the sibling
+      if (key > hdr.sibling_ptr->records[0].key) {
+        if (with_lock) {
+          hdr.vlock.unlock(); // Unlock the write lock
+        }
+        stats::add(STAT_SIBLING_HOP);
+        return hdr.sibling_ptr->store(bt, NULL, key, right, true, with_lock,
+                                      invalid_sibling, deferred);
+      }
+    }
+
+    register int num_entries = count();
+
+    // FAST
+    if (num_entries < cardinality - 1) {
+      insert_key(key, right, &num_entries, flush);
+      stats::add(STAT_FAST);
+
+      if (with_lock) {
+        hdr.vlock.unlock(); // Unlock the write lock
+      }
+
+      return this;
+    } else { // FAIR
+      flush_site site(SITE_SPLIT);
+
+      stats::add(STAT_FAIR);
+      // overflow
+      // create a new node
+      page *sibling = page::create(hdr.level);
+      register int m = (int)ceil(num_entries / 2);
+      entry_key_t split_key = records[m].key;
+
+      // migrate half of keys into the sibling
+      int sibling_cnt = 0;
+      if (hdr.leftmost_ptr == NULL) { // leaf node
+        for (int i = m; i < num_entries; ++i) {
+          sibling->insert_key(records[i].key, records[i].ptr, &sibling_cnt,
+                              false);
+        }
+      } else { // internal node
+        for (int i = m + 1; i < num_entries; ++i) {
+          sibling->insert_key(records[i].key, records[i].ptr, &sibling_cnt,
+                              false);
+        }
+        sibling->hdr.leftmost_ptr = child(records[m].ptr);
+      }
+
+      sibling->hdr.sibling_ptr = hdr.sibling_ptr;
+      Persist::persist(hdr.level, sibling, sizeof(page));
+
+      hdr.sibling_ptr = sibling;
+      Persist::persist(hdr.level, &hdr, sizeof(hdr));
+
+      // set to NULL
+      if (IS_FORWARD(hdr.switch_counter))
+        hdr.switch_counter += 2;
+      else
+        ++hdr.switch_counter;
+      records[m].ptr = NULL;
+      Persist::persist_flush(hdr.level, &records[m], sizeof(entry));
+
+      // last_index is only a hint for count(), so it can share the fence
+      hdr.last_index = m - 1;
+      Persist::persist_flush(hdr.level, &(hdr.last_index), sizeof(int16_t));
+      Persist::persist_drain(hdr.level);
+
+      num_entries = hdr.last_index + 1;
+
+      page *ret;
+
+      // insert the key
+      if (key < split_key) {
+        insert_key(key, right, &num_entries);
+        ret = this;
+      } else {
+        sibling->insert_key(key, right, &sibling_cnt);
+        ret = sibling;
+      }
+
+      insert_split(bt, split_key, sibling, with_lock, deferred);
+      return ret;
+    }
+  }
+
+  // Set a new root or insert the split key to the parent after this node
+  // split off sibling, unlocking this node first if with_lock
+  void insert_split(btree *bt, entry_key_t split_key, page *sibling,
+                    bool with_lock, std::vector<split_entry> *deferred) {
+    if (bt->root == this) { // only one node can update the root ptr
+      page *new_root =
+          page::create(this, split_key, sibling, hdr.level + 1);
+      bt->setNewRoot(new_root);
+
+      if (with_lock) {
+        hdr.vlock.unlock(); // Unlock the write lock
+      }
+      // the replicas are read without locks, so they follow once unlocked
+      if (bt->replica_levels)
+        bt->rebuild_replicas();
+    } else if (deferred) {
+      if (with_lock) {
+        hdr.vlock.unlock(); // Unlock the write lock
+      }
+      deferred->push_back({split_key, sibling, hdr.level + 1u});
+    } else {
+      if (with_lock) {
+        hdr.vlock.unlock(); // Unlock the write lock
+      }
+      bt->btree_insert_internal(NULL, split_key, word(sibling),
+                                hdr.level + 1);
+    }
+  }
+
+  // whether this leaf certainly holds the range of key: its keys span key,
+  // or it is the last leaf and key is above its first key
+  inline bool covers(entry_key_t key) {
+    if (hdr.unsorted)
+      return covers_unsorted(key);
+
+    int last = count() - 1;
+    if (last < 0 || key < records[0].key)
+      return false;
+    return hdr.sibling_ptr == NULL || key <= records[last].key;
+  }
+
+  // Store key in this leaf, found through a leaf hint, and return the page
+  // it went to; NULL, storing nothing, if the leaf does not cover key. The
+  // parent update of a split is left in *deferred.
+  page *store_hinted(btree *bt, entry_key_t key, char *right,
+                     std::vector<split_entry> *deferred) {
+    if (!covers(key)) // unlocked first look, so a miss takes no lock
+      return NULL;
+#ifdef RTM_ELISION
+    if (rtm_globals<>::lock_elision && store_elided(key, right, true))
+      return this;
+#endif
+
+    hdr.vlock.lock();
+    if (hdr.is_deleted || !covers(key)) {
+      hdr.vlock.unlock();
+      return NULL;
+    }
+    // key is below the sibling's keys, so store() takes no sibling hop
+    page *ret = store(bt, NULL, key, right, true, false, NULL, deferred);
+    hdr.vlock.unlock();
+    return ret;
+  }
+
+  // Append n ascending keys behind the last entry. The new entries and the
+  // new terminator are written and flushed past the current NULL terminator,
+  // where no reader looks, and a single store of the first pointer then
+  // publishes the whole run, so the run costs two fences instead of a shift
+  // per key.
+  inline void append_keys(entry_key_t *keys, Value *values, int n,
+                          int *num_entries) {
+    // update switch_counter
+    if (!IS_FORWARD(hdr.switch_counter))
+      ++hdr.switch_counter;
+
+    int first = *num_entries;
+    records[first + n].ptr = NULL;
+    for (int i = 1; i < n; ++i) {
+      records[first + i].key = keys[i];
+      records[first + i].ptr = (char *)values[i];
+    }
+    Persist::persist(hdr.level, &records[first + 1],
+            (n - 1) * sizeof(entry) + sizeof(char *));
+
+    records[first].key = keys[0];
+    compiler_barrier(); // the key and the run are in before the publish
+    records[first].ptr = (char *)values[0];
+    Persist::persist(hdr.level, &records[first], sizeof(entry));
+
+    hdr.last_index = first + n - 1;
+    *num_entries += n;
+  }
+
+  // Store a run of ascending keys that starts in this leaf and return how
+  // many were stored. Keys smaller than the last entry take the usual FAST
+  // shift, the rest are appended together. The run ends at the first key
+  // that belongs to the right sibling or right after a split, whose parent
+  // insert is left in *deferred.
+  int store_batch(btree *bt, entry_key_t *keys, Value *values, int num,
+                  std::vector<split_entry> *deferred) {
+    hdr.vlock.lock();
+    if (hdr.is_deleted) {
+      hdr.vlock.unlock();
+      return 0;
+    }
+
+    // If this node has a sibling node, the run may start there
+    // an unsorted leaf takes keys one at a time into free slots
+    if (hdr.unsorted) {
+      hdr.vlock.unlock();
+      return store(bt, NULL, keys[0], (char *)values[0], true, true, NULL,
+                   deferred) != NULL;
+    }
+
+    if (hdr.sibling_ptr && keys[0] > hdr.sibling_ptr->records[0].key) {
+      hdr.vlock.unlock();
+      stats::add(STAT_SIBLING_HOP);
+      return hdr.sibling_ptr->store_batch(bt, keys, values, num, deferred);
+    }
+
+    page *next = hdr.sibling_ptr;
+    int num_entries = count();
+    int done = 0;
+
+    while (done < num && !(next && keys[done] > next->records[0].key)) {
+      if (num_entries >= cardinality - 1) {
+        store(bt, NULL, keys[done], (char *)values[done], true, false, NULL,
+              deferred);
+        ++done;
+        break;
+      }
+
+      if (num_entries > 0 && keys[done] < records[num_entries - 1].key) {
+        insert_key(keys[done], (char *)values[done], &num_entries);
+        stats::add(STAT_FAST);
+        ++done;
+        continue;
+      }
+
+      int n = 1;
+      while (done + n < num && n < cardinality - 1 - num_entries &&
+             !(next && keys[done + n] > next->records[0].key))
+        ++n;
+      append_keys(keys + done, values + done, n, &num_entries);
+      stats::add(STAT_FAST, n);
+      done += n;
+    }
+
+    hdr.vlock.unlock();
+    return done;
+  }
+
+  // Copy the live entries of this leaf with min < key < max into keys and
+  // values, which hold cardinality slots, in ascending order and return how
+  // many were copied. *end is set if the leaf holds a key >= max; otherwise
+  // *next is the sibling to continue with. The copy restarts whenever the
+  // switch_counter moves, so nothing is staged twice from one leaf.
+  int scan_leaf(entry_key_t min, entry_key_t max, entry_key_t *keys,
+                char **values, bool *end, page **next) {
+    if (hdr.unsorted)
+      return scan_unsorted(min, max, keys, values, end, next);
+
+    int i, n;
+    uint8_t previous_switch_counter;
+    entry_key_t k;
+    char *t;
+
+    Persist::emulate_read();
+
+    hdr.vlock.read_lock();
+    do {
+      previous_switch_counter = hdr.switch_counter;
+      n = 0;
+      *end = false;
+
+      if (IS_FORWARD(previous_switch_counter)) {
+        for (i = 0; i < cardinality && records[i].ptr != NULL; ++i) {
+          // a shift in progress can show an entry twice, a new entry
+          // behind its neighbour or a stale key in the slot it moves into,
+          // so only a settled entry counts and the copy stays ascending
+          k = records[i].key;
+          compiler_barrier();
+          if ((t = records[i].ptr) == NULL ||
+              (i > 0 && t == records[i - 1].ptr))
+            continue;
+          compiler_barrier();
+          if (k != records[i].key) // the slot moved under us
+            continue;
+          if (k >= max) {
+            *end = true;
+            break;
+          }
+          if (k > (n > 0 ? keys[n - 1] : min)) {
+            keys[n] = k;
+            values[n++] = t;
+          }
+        }
+      } else {
+        for (i = count() - 1; i >= 0; --i) {
+          k = records[i].key;
+          compiler_barrier();
+          if ((t = records[i].ptr) == NULL ||
+              (i > 0 && t == records[i - 1].ptr))
+            continue;
+          compiler_barrier();
+          if (k != records[i].key) // the slot moved under us
+            continue;
+          if (k >= max) {
+            *end = true;
+            continue;
+          }
+          if (k > min && (n == 0 || k < keys[n - 1])) {
+            keys[n] = k;
+            values[n++] = t;
+          }
+        }
+        std::reverse(keys, keys + n);
+        std::reverse(values, values + n);
+      }
+
+      // read after the copy: a split that moved entries out has either
+      // bumped the switch_counter already or not started yet
+      *next = hdr.sibling_ptr;
+    } while (switch_counter_moved(previous_switch_counter));
+    hdr.vlock.read_unlock();
+
+    return n;
+  }
+
+  // Try the SIMD kernel on a node that is being searched left to right.
+  // Returns false if the kernel does not apply or the candidate slot is a
+  // transient duplicate, in which case the scalar scan decides.
+  inline bool simd_search(entry_key_t key, char **ret) {
+    int pos = simd_scan((const char *)records, cardinality, key,
+                        hdr.leftmost_ptr != NULL);
+    if (pos < 0)
+      return false;
+
+    int i = pos >> 1;
+    char *t;
+
+    if (hdr.leftmost_ptr == NULL) { // leaf node
+      if (pos & 1) {                // no match before the terminator
+        *ret = NULL;
+        return true;
+      }
+      t = records[i].ptr;
+      if (t == NULL || (i > 0 && records[i - 1].ptr == t) ||
+          records[i].key != key)
+        return false;
+      *ret = t;
+      return true;
+    }
+
+    // internal node: the child left of slot i, which must not be a
+    // duplicate of either neighbour
+    if (i == 0) {
+      t = word(hdr.leftmost_ptr);
+      if ((pos & 1) || t == records[0].ptr)
+        return false;
+      *ret = t;
+      return true;
+    }
+    t = records[i - 1].ptr;
+    if (t == NULL || t == records[i].ptr)
+      return false;
+    if (t == ((i == 1) ? word(hdr.leftmost_ptr) : records[i - 2].ptr))
+      return false;
+    *ret = t;
+    return true;
+  }
+
+  char *linear_search(entry_key_t key) {
+    if (hdr.unsorted) {
+      Persist::emulate_read();
+      return search_unsorted(key);
+    }
+
+    int i = 1;
+    uint8_t previous_switch_counter;
+    char *ret = NULL;
+    char *t;
+    entry_key_t k;
+
+    Persist::emulate_read();
+
+    if (hdr.leftmost_ptr == NULL) { // Search a leaf node
+      hdr.vlock.read_lock();
+      do {
+        previous_switch_counter = hdr.switch_counter;
+        ret = NULL;
+
+        // search from left ro right
+        if (IS_FORWARD(previous_switch_counter)) {
+          if (simd_search(key, &ret))
+            continue;
+
+          if ((k = records[0].key) == key) {
+            if ((t = records[0].ptr) != NULL) {
+              if (k == records[0].key) {
+                ret = t;
+                continue;
+              }
+            }
+          }
+
+          for (i = 1; i < cardinality && records[i].ptr != NULL; ++i) {
+            if ((k = records[i].key) == key) {
+              if (records[i - 1].ptr != (t = records[i].ptr)) {
+                if (k == records[i].key) {
+                  ret = t;
+                  break;
+                }
+              }
+            }
+          }
+        } else { // search from right to left
+          for (i = count() - 1; i > 0; --i) {
+            if ((k = records[i].key) == key) {
+              if (records[i - 1].ptr != (t = records[i].ptr) && t) {
+                if (k == records[i].key) {
+                  ret = t;
+                  break;
+                }
+              }
+            }
+          }
+
+          if (!ret) {
+            if ((k = records[0].key) == key) {
+              if (NULL != (t = records[0].ptr) && t) {
+                if (k == records[0].key) {
+                  ret = t;
+                  continue;
+                }
+              }
+            }
+          }
+        }
+      } while (switch_counter_moved(previous_switch_counter));
+
+      if (ret) {
+        hdr.vlock.read_unlock();
+        return ret;
+      }
+
+      if ((t = word(hdr.sibling_ptr)) && key >= child(t)->records[0].key) {
+        hdr.vlock.read_unlock();
+        stats::add(STAT_SIBLING_HOP);
+        return t;
+      }
+
+      hdr.vlock.read_unlock();
+      return NULL;
+    } else { // internal node
+      do {
+        previous_switch_counter = hdr.switch_counter;
+        ret = NULL;
+
+        if (IS_FORWARD(previous_switch_counter)) {
+          if (simd_search(key, &ret))
+            continue;
+
+          if (key < (k = records[0].key)) {
+            if ((t = word(hdr.leftmost_ptr)) != records[0].ptr) {
+              ret = t;
+              continue;
+            }
+          }
+
+          for (i = 1; i < cardinality && records[i].ptr != NULL; ++i) {
+            if (key < (k = records[i].key)) {
+              if ((t = records[i - 1].ptr) != records[i].ptr) {
+                ret = t;
+                break;
+              }
+            }
+          }
+
+          if (!ret) {
+            ret = records[i - 1].ptr;
+            continue;
+          }
+        } else { // search from right to left
+          for (i = count() - 1; i >= 0; --i) {
+            if (key >= (k = records[i].key)) {
+              if (i == 0) {
+                if (word(hdr.leftmost_ptr) != (t = records[i].ptr)) {
+                  ret = t;
+                  break;
+                }
+              } else {
+                if (records[i - 1].ptr != (t = records[i].ptr)) {
+                  ret = t;
+                  break;
+                }
+              }
+            }
+          }
+        }
+      } while (switch_counter_moved(previous_switch_counter));
+
+      if ((t = word(hdr.sibling_ptr)) != NULL) {
+        if (key >= child(t)->records[0].key) {
+          stats::add(STAT_SIBLING_HOP);
+          return t;
+        }
+      }
+
+      if (ret) {
+        return ret;
+      } else
+        return word(hdr.leftmost_ptr);
+    }
+
+    return NULL;
+  }
+
+  // pull every line of this page into the cache
+  inline void prefetch() {
+    for (int off = 0; off < PageSize; off += CACHE_LINE_SIZE)
+      __builtin_prefetch((char *)this + off);
+  }
+
+  // print a node
+  void print() {
+    if (hdr.leftmost_ptr == NULL)
+      printf("[%d] leaf %x \n", this->hdr.level, word(this));
+    else
+      printf("[%d] internal %x \n", this->hdr.level, word(this));
+    printf("last_index: %d\n", hdr.last_index);
+    printf("switch_counter: %d\n", hdr.switch_counter);
+    printf("search direction: ");
+    if (IS_FORWARD(hdr.switch_counter))
+      printf("->\n");
+    else
+      printf("<-\n");
+
+    if (hdr.leftmost_ptr != NULL)
+      printf("%x ", word(hdr.leftmost_ptr));
+
+    if (hdr.unsorted) {
+      for (uint64_t live = map()->bitmap; live; live &= live - 1) {
+        int i = __builtin_ctzll(live);
+        printf("%ld,%x ", (long)slot(i).key, slot(i).ptr);
+      }
+    }
+    for (int i = 0; !hdr.unsorted && records[i].ptr != NULL; ++i)
+      printf("%ld,%x ", (long)records[i].key, records[i].ptr);
+
+    printf("%x ", word(hdr.sibling_ptr));
+
+    printf("\n");
+  }
+
+  void printAll() {
+    if (hdr.leftmost_ptr == NULL) {
+      printf("printing leaf node: ");
+      print();
+    } else {
+      printf("printing internal node: ");
+      print();
+      hdr.leftmost_ptr->printAll();
+      for (int i = 0; records[i].ptr != NULL; ++i) {
+        child(records[i].ptr)->printAll();
+      }
+    }
+  }
+};
+
+// C++11 needs these wherever a constant is bound to a reference, as
+// std::min() does
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+constexpr int basic_page<Key, Value, PageSize, Lock, Persist>::cardinality;
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+constexpr int basic_page<Key, Value, PageSize, Lock, Persist>::count_in_line;
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+constexpr int basic_page<Key, Value, PageSize, Lock, Persist>::meta_entries;
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+constexpr int basic_page<Key, Value, PageSize, Lock, Persist>::leaf_slots;
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+constexpr uint64_t basic_page<Key, Value, PageSize, Lock, Persist>::all_slots;
+
+/*
+ * Range scan cursor
+ * A cursor returns the (key, value) pairs with min < key < max in ascending
+ * order, in chunks of the caller's size and at most limit pairs in total.
+ * Each leaf is staged in one consistent copy before any of it is handed out,
+ * and the scan only moves on to a sibling once the staged pairs are used up,
+ * so a short scan of a wide range touches only the leaves it returns. The
+ * next SCAN_PREFETCH_DEPTH leaves on the sibling chain are prefetched while
+ * the staged leaf is consumed. A cursor holds an epoch guard for its whole
+ * life, so it must be used and destroyed on the thread that made it.
+ */
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+class basic_cursor {
+  typedef Key entry_key_t;
+  typedef basic_btree<Key, Value, PageSize, Lock, Persist> btree;
+  typedef basic_page<Key, Value, PageSize, Lock, Persist> page;
+
+private:
+  typename Lock::guard guard; // pins the leaves until the cursor goes away
+  btree *bt;
+  page *leaf; // next leaf to stage, NULL at the end of the range
+  entry_key_t min, max;
+  long remaining;
+  int staged, pos;
+  entry_key_t keys[page::cardinality];
+  char *values[page::cardinality];
+
+  void prefetch_siblings() {
+    page *p = leaf;
+    for (int d = 0; d < SCAN_PREFETCH_DEPTH && p; ++d) {
+      p->prefetch();
+      p = p->hdr.sibling_ptr;
+    }
+  }
+
+  page *find_leaf(entry_key_t key) {
+    page *p = bt->root;
+
+    while (p->hdr.leftmost_ptr != NULL) {
+      p = page::child(p->linear_search(key));
+    }
+    return p;
+  }
+
+  // stage the next leaf that has pairs in range
+  bool fill() {
+    bool end;
+    page *next;
+
+    while (leaf) {
+      int n = leaf->scan_leaf(min, max, keys, values, &end, &next);
+      if (leaf->hdr.is_deleted) {
+        // merged away while we copied it: find where its pairs went
+        leaf = find_leaf(min);
+        continue;
+      }
+      leaf = end ? NULL : next;
+      prefetch_siblings();
+
+      if (n > 0) {
+        // a leaf that split under us may hand the same pairs to its sibling
+        min = keys[n - 1];
+        staged = n;
+        pos = 0;
+        return true;
+      }
+    }
+    return false;
+  }
+
+public:
+  basic_cursor(btree *bt, entry_key_t min, entry_key_t max,
+               long limit = LONG_MAX)
+      : bt(bt), min(min), max(max), remaining(limit), staged(0), pos(0) {
+    leaf = find_leaf(min);
+  }
+
+  // Copy up to n pairs into out_keys (may be NULL) and out_values and return
+  // how many were copied; 0 means the scan is over
+  int next(entry_key_t *out_keys, Value *out_values, int n) {
+    int copied = 0;
+
+    while (copied < n && remaining > 0) {
+      if (pos == staged && !fill())
+        break;
+
+      int c = std::min(n - copied, staged - pos);
+      if (c > remaining)
+        c = (int)remaining;
+      for (int i = 0; i < c; ++i) {
+        if (out_keys)
+          out_keys[copied + i] = keys[pos + i];
+        out_values[copied + i] = (Value)values[pos + i];
+      }
+      copied += c;
+      pos += c;
+      remaining -= c;
+    }
+    return copied;
+  }
+};
+
+/*
+ * class btree
+ */
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+basic_btree<Key, Value, PageSize, Lock, Persist>::basic_btree()
+    : pool(NULL), serial(++globals::tree_serial), generation(1), hybrid(0),
+      compactor(NULL), compactor_stop(false), replica_levels(0), replicas() {
+  root = head = page::create();
+  if (globals::unsorted_leaves)
+    root->make_unsorted();
+  height = 1;
+}
+
+// Attach to the tree of an open DAX pool, or set one up in a new pool.
+// Opening takes no pass over the pages; the height is told by the root.
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+basic_btree<Key, Value, PageSize, Lock, Persist>::basic_btree(pool_type *pool)
+    : pool(pool), serial(++globals::tree_serial), generation(1), hybrid(0),
+      compactor(NULL), compactor_stop(false), replica_levels(0), replicas() {
+  if (!pool->format(sizeof(page))) {
+    fprintf(stderr, "the DAX pool holds pages of another size\n");
+    exit(1);
+  }
+
+  if ((root = (page *)pool->root()) != NULL) {
+    if (!Lock::durable) {
+      fprintf(stderr, "reopening a pool is not supported with this lock\n");
+      exit(1);
+    }
+    height = root->hdr.level + 1;
+    for (head = root; head->hdr.leftmost_ptr != NULL;)
+      head = head->hdr.leftmost_ptr;
+    return;
+  }
+
+  root = head = page::create();
+  if (globals::unsorted_leaves)
+    root->make_unsorted();
+  Persist::persist(0, root, sizeof(page));
+  height = 1;
+  pool->set_root(Persist::word(root));
+}
+
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+basic_btree<Key, Value, PageSize, Lock, Persist>::~basic_btree() {
+  stop_compactor();
+  for (int i = 0; i < NUMA_MAX_NODES; ++i)
+    if (replicas[i])
+      numa_replica<Key>::release(replicas[i]);
+}
+
+// Set up a tree in the pool object this, which pop holds. In hybrid mode
+// only the leaves are kept in the pool.
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+void basic_btree<Key, Value, PageSize, Lock, Persist>::constructor(
+    pool_type *pop, bool hybrid_mode) {
+  pool = pop;
+  Persist::attach(pop, this, hybrid_mode);
+  hybrid = hybrid_mode;
+  serial = ++globals::tree_serial;
+  reset();
+  generation = lock_globals<>::lock_generation = 1;
+  root = head = page::create(0);
+  if (globals::unsorted_leaves)
+    root->make_unsorted();
+  Persist::persist(0, root, sizeof(page));
+  height = 1;
+  Persist::persist_tree(this, sizeof(*this));
+}
+
+// Attach to a tree in a pool that has been opened again. The DRAM state is
+// set up again and the pool generation is bumped, which turns every lock
+// word written before the restart into a free one, so this takes the same
+// time whatever the size of the tree. A hybrid tree also gets its internal
+// levels back, built from the leaves by num_threads threads.
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+void basic_btree<Key, Value, PageSize, Lock, Persist>::open(pool_type *pop,
+                                                            int num_threads) {
+  if (!Lock::durable) {
+    fprintf(stderr, "reopening a pool is not supported with this lock\n");
+    exit(1);
+  }
+  pool = pop;
+  Persist::attach(pop, this, hybrid);
+  serial = ++globals::tree_serial;
+  reset();
+  lock_globals<>::lock_generation = ++generation;
+  Persist::persist_tree(&generation, sizeof(generation));
+
+  if (hybrid)
+    rebuild_inner(num_threads);
+}
+
+// Build the internal levels over pages, whose smallest keys are low_keys,
+// with up to per_page + 1 children a node, and make the top page the root.
+// Each level is built in parallel by key range and persisted once unless
+// it is kept in DRAM.
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+void basic_btree<Key, Value, PageSize, Lock, Persist>::build_levels(
+    std::vector<page *> &pages, std::vector<entry_key_t> &low_keys,
+    int per_page, int num_threads) {
+  long num_pages = pages.size();
+  uint32_t level = pages[0]->hdr.level;
+
+  while (num_pages > 1) {
+    long num_children = num_pages;
+    num_pages = (num_children + per_page) / (per_page + 1);
+    std::vector<page *> parents(num_pages);
+    std::vector<entry_key_t> parent_low_keys(num_pages);
+    ++level;
+
+    parallel_for(num_pages, num_threads, [&](long begin, long end) {
+      for (long i = begin; i < end; ++i)
+        parents[i] = page::create(level);
+    });
+    parallel_for(num_pages, num_threads, [&](long begin, long end) {
+      flush_site site(SITE_BULK_LOAD);
+
+      for (long i = begin; i < end; ++i) {
+        page *p = parents[i];
+        long first = num_children * i / num_pages;
+        long last = num_children * (i + 1) / num_pages;
+        int m = 0;
+
+        p->hdr.leftmost_ptr = pages[first];
+        for (long j = first + 1; j < last; ++j, ++m) {
+          p->records[m].key = low_keys[j];
+          p->records[m].ptr = page::word(pages[j]);
+        }
+        p->records[m].ptr = NULL;
+        p->hdr.last_index = m - 1;
+        if (i + 1 < num_pages)
+          p->hdr.sibling_ptr = parents[i + 1];
+        parent_low_keys[i] = low_keys[first];
+
+        Persist::persist(level, p, sizeof(page));
+      }
+    });
+
+    pages.swap(parents);
+    low_keys.swap(parent_low_keys);
+  }
+
+  height = level; // setNewRoot() counts the root level
+  setNewRoot(pages[0]);
+}
+
+// Index the leaf chain of a hybrid tree again after a restart. The chain is
+// walked once to collect the leaves; an empty leaf has no key to be indexed
+// by, so it is unlinked and freed on the way, except for the head. The
+// levels above are then built in DRAM like a bulk load.
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+void basic_btree<Key, Value, PageSize, Lock, Persist>::rebuild_inner(
+    int num_threads) {
+  std::vector<page *> leaves;
+  page *p = head;
+
+  while (true) {
+    leaves.push_back(p);
+
+    page *next = p->hdr.sibling_ptr;
+    while (next != NULL && next->count() == 0) {
+      page *empty = next;
+      next = next->hdr.sibling_ptr;
+      p->hdr.sibling_ptr = next;
+      Persist::persist(0, &p->hdr.sibling_ptr, sizeof(p->hdr.sibling_ptr));
+      page::destroy(empty);
+    }
+    if (next == NULL)
+      break;
+    p = next;
+  }
+
+  std::vector<entry_key_t> low_keys(leaves.size());
+  parallel_for(leaves.size(), num_threads, [&](long begin, long end) {
+    for (long i = begin; i < end; ++i)
+      low_keys[i] = leaves[i]->low_key();
+  });
+
+  build_levels(leaves, low_keys, page::cardinality - 1, num_threads);
+}
+
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+void basic_btree<Key, Value, PageSize, Lock, Persist>::setNewRoot(
+    page *new_root) {
+  flush_site site(SITE_NEW_ROOT);
+
+  Persist::set_root(pool, root, new_root, new_root->hdr.level);
+  ++height;
+}
+
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+Value basic_btree<Key, Value, PageSize, Lock, Persist>::btree_search(
+    entry_key_t key) {
+  typename Lock::guard guard;
+  page *p;
+  char *t;
+
+  if ((p = hinted(globals::search_hint)) != NULL) {
+    t = p->linear_search(key);
+    if (t && t != page::word(p->hdr.sibling_ptr) && !p->hdr.is_deleted) {
+      stats::add(STAT_HINT_HIT);
+      return (Value)t;
+    }
+  }
+
+  do {
+    p = top(key);
+
+    while (p->hdr.leftmost_ptr != NULL) {
+      p = page::child(p->linear_search(key));
+    }
+
+    while ((t = p->linear_search(key)) == page::word(p->hdr.sibling_ptr)) {
+      p = page::child(t);
+      if (!p) {
+        break;
+      }
+    }
+    // the leaf was merged away while we read it and may have lost the key
+  } while (p && p->hdr.is_deleted);
+
+  if (!t) {
+    printf("NOT FOUND %lu, t = %x\n", (unsigned long)key, t);
+    return NULL;
+  }
+
+  if (globals::leaf_hints)
+    remember(globals::search_hint, p);
+  return (Value)t;
+}
+
+// Look up n keys and store each value, or NULL for a missing key, in out.
+// The lookups go down in groups of MULTI_SEARCH_GROUP, one level per round,
+// and the page each lookup moves to is prefetched before the next lookup of
+// the group reads its own, so the group keeps that many misses in flight
+// instead of one.
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+void basic_btree<Key, Value, PageSize, Lock, Persist>::btree_multi_search(
+    entry_key_t *keys, int n, Value *out) {
+  typename Lock::guard guard;
+  page *p[MULTI_SEARCH_GROUP];
+
+  for (int base = 0; base < n; base += MULTI_SEARCH_GROUP) {
+    int m = std::min(n - base, MULTI_SEARCH_GROUP);
+    entry_key_t *k = keys + base;
+    bool descending = true;
+
+    for (int i = 0; i < m; ++i)
+      p[i] = top(k[i]);
+
+    while (descending) {
+      descending = false;
+      for (int i = 0; i < m; ++i) {
+        if (p[i]->hdr.leftmost_ptr != NULL) {
+          p[i] = page::child(p[i]->linear_search(k[i]));
+          p[i]->prefetch();
+          descending = true;
+        }
+      }
+    }
+
+    for (int i = 0; i < m; ++i) {
+      char *t;
+      for (;;) {
+        while ((t = p[i]->linear_search(k[i])) ==
+               page::word(p[i]->hdr.sibling_ptr)) {
+          p[i] = page::child(t);
+          if (!p[i])
+            break;
+        }
+        // the leaf was merged away while we read it and may have lost the key
+        if (!p[i] || !p[i]->hdr.is_deleted)
+          break;
+
+        p[i] = top(k[i]);
+        while (p[i]->hdr.leftmost_ptr != NULL)
+          p[i] = page::child(p[i]->linear_search(k[i]));
+      }
+      out[base + i] = (Value)t;
+    }
+  }
+}
+
+// insert the key in the leaf node
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+void basic_btree<Key, Value, PageSize, Lock, Persist>::btree_insert(
+    entry_key_t key, Value value) {
+  flush_op op(FLUSH_OP_INSERT);
+  typename Lock::guard guard;
+  char *right = (char *)value;
+  unsigned long start_tsc = read_tsc();
+  unsigned long long flush_start = stats::get(STAT_FLUSH_CYCLES);
+  std::vector<typename page::split_entry> deferred;
+  page *p = hinted(globals::insert_hint), *stored = NULL;
+
+  if (p && (stored = p->store_hinted(this, key, right, &deferred)) != NULL) {
+    unsigned long long flush = stats::get(STAT_FLUSH_CYCLES) - flush_start;
+
+    stats::add(STAT_HINT_HIT);
+    stats::add(STAT_UPDATE_CYCLES, read_tsc() - start_tsc - flush);
+    remember(globals::insert_hint, stored);
+    for (size_t i = 0; i < deferred.size(); ++i) {
+      btree_insert_internal(NULL, deferred[i].key,
+                            page::word(deferred[i].sibling), deferred[i].level);
+    }
+    return;
+  }
+
+  p = top(key);
+  while (p->hdr.leftmost_ptr != NULL) {
+    p = page::child(p->linear_search(key));
+  }
+
+  unsigned long searched_tsc = read_tsc();
+  flush_start = stats::get(STAT_FLUSH_CYCLES);
+  stored = p->store(this, NULL, key, right, true, true); // store
+  unsigned long long flush = stats::get(STAT_FLUSH_CYCLES) - flush_start;
+  unsigned long end_tsc = read_tsc();
+
+  stats::add(STAT_SEARCH_CYCLES, searched_tsc - start_tsc);
+  stats::add(STAT_UPDATE_CYCLES, end_tsc - searched_tsc - flush);
+
+  if (!stored) {
+    stats::add(STAT_STORE_RESTART);
+    btree_insert(key, value);
+  } else if (globals::leaf_hints) {
+    remember(globals::insert_hint, stored);
+  }
+}
+
+// insert num keys sorted in ascending order: one descent and one lock per leaf,
+// and the parents of the leaves that split are updated once the batch is in
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+void basic_btree<Key, Value, PageSize, Lock, Persist>::btree_insert_batch(
+    entry_key_t *keys, Value *values, int num) {
+  typename Lock::guard guard;
+  std::vector<typename page::split_entry> deferred;
+  int done = 0;
+
+  while (done < num) {
+    page *p = top(keys[done]);
+
+    while (p->hdr.leftmost_ptr != NULL) {
+      p = page::child(p->linear_search(keys[done]));
+    }
+
+    done += p->store_batch(this, keys + done, values + done, num - done,
+                           &deferred);
+  }
+
+  for (size_t i = 0; i < deferred.size(); ++i) {
+    btree_insert_internal(NULL, deferred[i].key,
+                          page::word(deferred[i].sibling), deferred[i].level);
+  }
+}
+
+// Build the tree bottom-up from num keys sorted in ascending order. Every
+// level is built in parallel by key range: pages are filled to fill_factor,
+// linked to their right sibling and flushed once, and the new root is
+// published last. A tree that already holds keys takes them through
+// btree_insert_batch() instead. Must not run concurrently with other
+// operations on the tree.
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+void basic_btree<Key, Value, PageSize, Lock, Persist>::btree_bulk_load(
+    entry_key_t *keys, Value *values, long num, double fill_factor,
+    int num_threads) {
+  page *old_root = root;
+
+  if (num <= 0)
+    return;
+
+  if (height != 1 || old_root->count() != 0) {
+    for (long i = 0; i < num; i += INT_MAX)
+      btree_insert_batch(keys + i, values + i,
+                         (int)std::min(num - i, (long)INT_MAX));
+    return;
+  }
+
+  // entries per page, at least 3 so that no internal node is left with
+  // a single child
+  int per_page = (int)((page::cardinality - 1) * fill_factor);
+  per_page = std::max(3, std::min(page::cardinality - 1, per_page));
+
+  // unsorted leaves take the tree's leaf format and fill their slots
+  bool unsorted = old_root->hdr.unsorted;
+  int leaf_per_page = (int)(page::leaf_slots * fill_factor);
+  leaf_per_page = std::max(1, std::min(page::leaf_slots, leaf_per_page));
+  if (!unsorted)
+    leaf_per_page = per_page;
+
+  long num_pages = (num + leaf_per_page - 1) / leaf_per_page;
+  std::vector<page *> pages(num_pages);
+  std::vector<entry_key_t> low_keys(num_pages);
+  uint32_t level = 0;
+
+  // leaves
+  parallel_for(num_pages, num_threads, [&](long begin, long end) {
+    for (long i = begin; i < end; ++i)
+      pages[i] = page::create(level);
+  });
+  parallel_for(num_pages, num_threads, [&](long begin, long end) {
+    flush_site site(SITE_BULK_LOAD);
+
+    for (long i = begin; i < end; ++i) {
+      page *p = pages[i];
+      long first = num * i / num_pages, last = num * (i + 1) / num_pages;
+      int m = 0;
+
+      if (unsorted) {
+        p->make_unsorted(keys[first]);
+        for (long j = first; j < last; ++j, ++m) {
+          p->slot(m).key = keys[j];
+          p->slot(m).ptr = (char *)values[j];
+          p->map()->fingerprint[m] = page::fingerprint(keys[j]);
+        }
+        p->map()->bitmap = page::first_slots(m);
+      } else {
+        for (long j = first; j < last; ++j, ++m) {
+          p->records[m].key = keys[j];
+          p->records[m].ptr = (char *)values[j];
+        }
+        p->records[m].ptr = NULL;
+        p->hdr.last_index = m - 1;
+      }
+      p->hdr.sibling_ptr = (i + 1 < num_pages) ? pages[i + 1] : NULL;
+      low_keys[i] = keys[first];
+
+      Persist::persist(level, p, sizeof(page));
+    }
+  });
+
+  head = pages[0];
+  Persist::persist_tree(&head, sizeof(head));
+
+  build_levels(pages, low_keys, per_page, num_threads);
+  page::destroy(old_root);
+  if (replica_levels)
+    rebuild_replicas();
+}
+
+// store the key into the node at the given level
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+void basic_btree<Key, Value, PageSize, Lock, Persist>::btree_insert_internal(
+    char *left, entry_key_t key, char *right, uint32_t level) {
+  if (level > ((page *)root)->hdr.level)
+    return;
+
+  page *p = (page *)this->root;
+
+  while (p->hdr.level > level)
+    p = page::child(p->linear_search(key));
+
+  if (!p->store(this, NULL, key, right, true, true)) {
+    btree_insert_internal(left, key, right, level);
+  } else if (replica_levels) {
+    replica_insert(key, page::child(right), level);
+  }
+}
+
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+void basic_btree<Key, Value, PageSize, Lock, Persist>::btree_delete(
+    entry_key_t key) {
+  flush_op op(FLUSH_OP_DELETE);
+  typename Lock::guard guard;
+  page *p = top(key);
+
+  while (p->hdr.leftmost_ptr != NULL) {
+    p = page::child(p->linear_search(key));
+  }
+
+  char *t;
+  while ((t = p->linear_search(key)) == page::word(p->hdr.sibling_ptr)) {
+    p = page::child(t);
+    if (!p)
+      break;
+  }
+
+  if (p) {
+    if (!p->remove(this, key)) {
+      btree_delete(key);
+    }
+  } else {
+    printf("not found the key to delete %lu\n", (unsigned long)key);
+  }
+}
+
+// replace the value of key in place; returns false, storing nothing, if the key
+// is not in the tree
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+bool basic_btree<Key, Value, PageSize, Lock, Persist>::btree_update(
+    entry_key_t key, Value value) {
+  flush_op op(FLUSH_OP_UPDATE);
+  typename Lock::guard guard;
+  page *p = top(key);
+  bool found;
+
+  while (p->hdr.leftmost_ptr != NULL) {
+    p = page::child(p->linear_search(key));
+  }
+
+  if (!p->update(this, key, (char *)value, false, &found, NULL)) {
+    return btree_update(key, value);
+  }
+  return found;
+}
+
+// replace the value of key in place, or insert the key if it is not in the
+// tree; returns true if an existing value was replaced
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+bool basic_btree<Key, Value, PageSize, Lock, Persist>::btree_upsert(
+    entry_key_t key, Value value) {
+  flush_op op(FLUSH_OP_UPDATE);
+  typename Lock::guard guard;
+  std::vector<typename page::split_entry> deferred;
+  page *p = top(key);
+  bool found;
+
+  while (p->hdr.leftmost_ptr != NULL) {
+    p = page::child(p->linear_search(key));
+  }
+
+  if (!p->update(this, key, (char *)value, true, &found, &deferred)) {
+    return btree_upsert(key, value);
+  }
+
+  for (size_t i = 0; i < deferred.size(); ++i) {
+    btree_insert_internal(NULL, deferred[i].key,
+                          page::word(deferred[i].sibling), deferred[i].level);
+  }
+  return found;
+}
+
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+void basic_btree<Key, Value, PageSize, Lock, Persist>::btree_delete_internal(
+    entry_key_t key, char *ptr, uint32_t level, entry_key_t *deleted_key,
+    bool *is_leftmost_node, page **left_sibling) {
+  if (level > ((page *)this->root)->hdr.level)
+    return;
+
+  page *p = (page *)this->root;
+
+  while (p->hdr.level > level) {
+    p = page::child(p->linear_search(key));
+  }
+
+  p->hdr.vlock.lock();
+
+  if (page::word(p->hdr.leftmost_ptr) == ptr) {
+    *is_leftmost_node = true;
+    p->hdr.vlock.unlock();
+    return;
+  }
+
+  *is_leftmost_node = false;
+
+  for (int i = 0; p->records[i].ptr != NULL; ++i) {
+    if (p->records[i].ptr == ptr) {
+      if (i == 0) {
+        if (page::word(p->hdr.leftmost_ptr) != p->records[i].ptr) {
+          *deleted_key = p->records[i].key;
+          *left_sibling = p->hdr.leftmost_ptr;
+          if (!Lock::concurrent) {
+            p->remove(this, *deleted_key); // rebalances p, which may go
+            return;
+          }
+          p->remove_key(*deleted_key); // p is locked already
+          break;
+        }
+      } else {
+        if (p->records[i - 1].ptr != p->records[i].ptr) {
+          *deleted_key = p->records[i].key;
+          *left_sibling = page::child(p->records[i - 1].ptr);
+          if (!Lock::concurrent) {
+            p->remove(this, *deleted_key);
+            return;
+          }
+          p->remove_key(*deleted_key);
+          break;
+        }
+      }
+    }
+  }
+
+  p->hdr.vlock.unlock();
+}
+
+// Function to search keys from "min" to "max"
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+void basic_btree<Key, Value, PageSize, Lock, Persist>::btree_search_range(
+    entry_key_t min, entry_key_t max, unsigned long *buf) {
+  basic_cursor<Key, Value, PageSize, Lock, Persist> cursor(this, min, max);
+  Value chunk[page::cardinality];
+  int n;
+
+  while ((n = cursor.next(NULL, chunk, page::cardinality)) > 0) {
+    for (int i = 0; i < n; ++i)
+      *buf++ = (unsigned long)chunk[i];
+  }
+}
+
+// the leaf whose range holds key, or one left of it
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+typename basic_btree<Key, Value, PageSize, Lock, Persist>::page *
+basic_btree<Key, Value, PageSize, Lock, Persist>::find_leaf(entry_key_t key) {
+  page *p = top(key);
+
+  while (p->hdr.leftmost_ptr != NULL) {
+    p = page::child(p->linear_search(key));
+  }
+  return p;
+}
+
+// Fill bounds with ascending separator keys in (min, max) that cut it into
+// about parts sub-ranges, from the highest internal level with enough of
+// them. A key may no longer be in the leaves; it still splits the range.
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+void basic_btree<Key, Value, PageSize, Lock, Persist>::scan_bounds(
+    entry_key_t min, entry_key_t max, long parts,
+    std::vector<entry_key_t> *bounds) {
+  entry_key_t keys[page::cardinality];
+  char *values[page::cardinality];
+  typename Lock::guard guard;
+  page *top = (page *)root;
+
+  for (int level = top->hdr.level; level > 0; --level) {
+    page *p = top, *next;
+    bool end = false;
+
+    while (p->hdr.level > level) {
+      p = page::child(p->linear_search(min));
+    }
+
+    bounds->clear();
+    for (; p && !end; p = next) {
+      int n = p->scan_leaf(min, max, keys, values, &end, &next);
+      for (int i = 0; i < n; ++i)
+        if (bounds->empty() || keys[i] > bounds->back())
+          bounds->push_back(keys[i]);
+    }
+    if ((long)bounds->size() + 1 >= parts)
+      break;
+  }
+
+  // a level below one with too few keys has up to a fanout more
+  size_t step = (bounds->size() + parts) / parts, kept = 0;
+  if (step > 1) {
+    for (size_t i = step - 1; i < bounds->size(); i += step)
+      (*bounds)[kept++] = (*bounds)[i];
+    bounds->resize(kept);
+  }
+}
+
+// Hand the pairs with lo < key < hi, and lo itself if with_lo, to visit as
+// the given worker
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+template <typename F>
+void basic_btree<Key, Value, PageSize, Lock, Persist>::scan_range(
+    entry_key_t lo, bool with_lo, entry_key_t hi, int worker, const F &visit) {
+  entry_key_t keys[page::cardinality];
+  char *values[page::cardinality];
+  bool end = false;
+
+  while (!end) {
+    typename Lock::guard guard;
+    page *leaf = find_leaf(lo), *next;
+
+    // scan_leaf() only takes keys above lo, so lo is looked up first
+    if (with_lo) {
+      page *p = leaf;
+      char *t;
+
+      while ((t = p->linear_search(lo)) != NULL &&
+             t == page::word(p->hdr.sibling_ptr)) {
+        p = page::child(t);
+      }
+      if (p->hdr.is_deleted)
+        continue; // merged away while we read it
+      if (t)
+        visit(worker, &lo, (Value *)&t, 1);
+      with_lo = false;
+    }
+
+    for (int i = 0; i < SCAN_GUARD_LEAVES && !end; ++i) {
+      int n = leaf->scan_leaf(lo, hi, keys, values, &end, &next);
+      if (leaf->hdr.is_deleted) {
+        // merged away while we copied it: find where its pairs went
+        end = false;
+        leaf = find_leaf(lo);
+        continue;
+      }
+
+      if (n > 0) {
+        visit(worker, keys, (Value *)values, n);
+        lo = keys[n - 1];
+      }
+      if ((leaf = next) == NULL)
+        end = true;
+    }
+  }
+}
+
+// Call visit(worker, keys, values, n) on the pairs with min < key < max,
+// read by num_threads workers (see "Parallel scan")
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+template <typename F>
+void basic_btree<Key, Value, PageSize, Lock, Persist>::btree_parallel_scan(
+    entry_key_t min, entry_key_t max, const F &visit, int num_threads) {
+  std::vector<entry_key_t> bounds;
+  std::atomic<long> next_range(0);
+
+  num_threads = std::max(1, num_threads);
+  scan_bounds(min, max, (long)num_threads * SCAN_RANGES_PER_THREAD, &bounds);
+  long num_ranges = bounds.size() + 1;
+
+  parallel_for(num_threads, num_threads, [&](long begin, long end) {
+    for (long w = begin; w < end; ++w) {
+      for (long r; (r = next_range++) < num_ranges;)
+        scan_range(r == 0 ? min : bounds[r - 1], r > 0,
+                   r + 1 < num_ranges ? bounds[r] : max, (int)w, visit);
+    }
+  });
+}
+
+// Count, sum the values of and find the smallest and largest of the keys
+// with min < key < max, on num_threads workers
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+scan_aggregate<Key>
+basic_btree<Key, Value, PageSize, Lock, Persist>::btree_aggregate(
+    entry_key_t min, entry_key_t max, int num_threads) {
+  std::vector<scan_aggregate<Key>> parts(std::max(1, num_threads));
+  scan_aggregate<Key> total;
+
+  btree_parallel_scan(
+      min, max,
+      [&](int worker, const entry_key_t *keys, Value *values, int n) {
+        parts[worker].add(keys, values, n);
+      },
+      num_threads);
+  for (size_t i = 0; i < parts.size(); ++i)
+    total.merge(parts[i]);
+  return total;
+}
+
+// Merge or redistribute the underfull leaves in one pass over the leaf
+// level and return how many were rebalanced. The pass follows the parents
+// of the leaves; their first child has no left sibling to merge into and
+// is handled along with the child after it. The epoch guard is held for
+// one parent at a time: internal nodes are never freed, so the walk may
+// hold on to one between guards. Passes are serialized.
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+long basic_btree<Key, Value, PageSize, Lock, Persist>::btree_compact() {
+  // a tree without locks rebalances on every delete
+  if (!Lock::concurrent)
+    return 0;
+
+  std::lock_guard<std::mutex> lock(compact_mtx);
+  long visited = 0, next_pause = globals::compact_batch, rebalanced = 0;
+  page *p;
+
+  {
+    typename Lock::guard guard;
+    p = (page *)root;
+    if (p->hdr.leftmost_ptr == NULL)
+      return 0;
+    while (p->hdr.leftmost_ptr->hdr.leftmost_ptr != NULL)
+      p = p->hdr.leftmost_ptr;
+  }
+
+  for (; p != NULL && !compactor_stop; p = p->hdr.sibling_ptr) {
+    {
+      typename Lock::guard guard;
+
+      for (int i = 0; i < page::cardinality; ++i) {
+        uint8_t previous_switch_counter = p->hdr.switch_counter;
+        page *child = page::child(p->records[i].ptr);
+        entry_key_t key = p->records[i].key;
+
+        if (child == NULL)
+          break;
+        // a shift moved the pair while we read it; the next pass gets it
+        if (previous_switch_counter != p->hdr.switch_counter)
+          continue;
+
+        if (child->count() < (int)(child->capacity() * globals::compact_fill) &&
+            child->remove_rebalancing(this, key, true, true))
+          ++rebalanced;
+        ++visited;
+      }
+    }
+
+    if (visited >= next_pause) {
+      if (globals::compact_pause_us)
+        usleep(globals::compact_pause_us);
+      next_pause = visited + globals::compact_batch;
+    }
+  }
+
+  Lock::reclaim();
+  return rebalanced;
+}
+
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+void basic_btree<Key, Value, PageSize, Lock, Persist>::start_compactor() {
+  if (compactor)
+    return;
+
+  compactor_stop = false;
+  compactor = new std::thread([this] {
+    while (!compactor_stop) {
+      if (btree_compact() == 0)
+        usleep(globals::compact_idle_ms * 1000);
+    }
+  });
+}
+
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+void basic_btree<Key, Value, PageSize, Lock, Persist>::stop_compactor() {
+  if (!compactor)
+    return;
+
+  compactor_stop = true;
+  compactor->join();
+  delete compactor;
+  compactor = NULL;
+}
+
+// Append to keys and pages the pages at level under p and its right
+// siblings up to stop, each with the lowest key it may hold, in key order.
+// The leftmost child of a sibling that split off after its parent was read
+// is left out: only the parent has its low key, and it is one sibling hop
+// from the page left of it. Pages are read without locks and copied again
+// if a writer changed them.
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+void basic_btree<Key, Value, PageSize, Lock, Persist>::collect_replica(
+    page *p, page *stop, bool has_low, entry_key_t low, uint32_t level,
+    std::vector<entry_key_t> *keys, std::vector<void *> *pages) {
+  struct child {
+    page *p;
+    bool has_low;
+    entry_key_t low;
+  };
+  std::vector<child> children;
+  entry_key_t k[page::cardinality];
+  page *c[page::cardinality];
+
+  for (page *q = p, *sibling; q != NULL && q != stop; q = sibling) {
+    page *leftmost;
+    uint64_t v;
+    int n;
+
+    do {
+      v = q->hdr.vlock.read_begin();
+      leftmost = q->hdr.leftmost_ptr;
+      sibling = q->hdr.sibling_ptr;
+      for (n = 0; n < page::cardinality && q->records[n].ptr != NULL; ++n) {
+        k[n] = q->records[n].key;
+        c[n] = page::child(q->records[n].ptr);
+      }
+    } while (!q->hdr.vlock.validate(v));
+
+    children.push_back({leftmost, q == p && has_low, low});
+    for (int i = 0; i < n; ++i)
+      children.push_back({c[i], true, k[i]});
+  }
+
+  if (p->hdr.level == level + 1) {
+    for (size_t i = 0; i < children.size(); ++i) {
+      // the key of the leftmost page of the level is never read
+      if (pages->empty() ||
+          (children[i].has_low && keys->back() < children[i].low)) {
+        keys->push_back(children[i].low);
+        pages->push_back(children[i].p);
+      }
+    }
+    return;
+  }
+
+  for (size_t i = 0; i < children.size(); ++i) {
+    page *next = i + 1 < children.size() ? children[i + 1].p
+                 : stop                  ? (page *)stop->hdr.leftmost_ptr
+                                         : NULL;
+    collect_replica(children[i].p, next, children[i].has_low, children[i].low,
+                    level, keys, pages);
+  }
+}
+
+// give every node a replica of keys and pages at level; the old ones are
+// retired, as a descent may still be routed by them
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+void basic_btree<Key, Value, PageSize, Lock, Persist>::publish_replicas(
+    uint32_t level, const std::vector<entry_key_t> &keys,
+    const std::vector<void *> &pages) {
+  for (int i = 0; i < numa_nodes(); ++i) {
+    numa_replica<Key> *r = numa_replica<Key>::create(
+        i, level, keys.data(), pages.data(), (int)pages.size());
+
+    if ((r = replicas[i].exchange(r)) != NULL)
+      Lock::retire(r, numa_replica<Key>::release);
+  }
+}
+
+// Replace the replicas with a copy of the top levels as they are now. The
+// pages a replica routes to are internal nodes, which are never freed and
+// never lose keys to a sibling, so a replica stays correct as long as it
+// lives; a page it misses only costs sibling hops.
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+void basic_btree<Key, Value, PageSize, Lock, Persist>::rebuild_replicas() {
+  std::lock_guard<std::mutex> lock(replica_mtx);
+  typename Lock::guard guard;
+  std::vector<entry_key_t> keys;
+  std::vector<void *> pages;
+  page *r = (page *)root;
+  int top_level = r->hdr.level;
+  uint32_t level = std::max(top_level - replica_levels, 1);
+
+  if (replica_levels > 0 && top_level >= 2)
+    collect_replica(r, NULL, false, entry_key_t(), level, &keys, &pages);
+  publish_replicas(level, keys, pages);
+}
+
+// add right, which btree_insert_internal() just linked at level, to the
+// replicas if they route to its level
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+void basic_btree<Key, Value, PageSize, Lock, Persist>::replica_insert(
+    entry_key_t key, page *right, uint32_t level) {
+  numa_replica<Key> *r = replicas[0].load(std::memory_order_acquire);
+  if (r == NULL || r->page_level() + 1 != level)
+    return;
+
+  std::lock_guard<std::mutex> lock(replica_mtx);
+  typename Lock::guard guard;
+  if ((r = replicas[0].load()) == NULL || r->page_level() + 1 != level)
+    return;
+
+  int n = r->size(), pos = 1;
+  while (pos < n && !(key < r->key(pos)))
+    ++pos;
+  if (pos > 1 && !(r->key(pos - 1) < key))
+    return; // a rebuild already found it
+
+  std::vector<entry_key_t> keys;
+  std::vector<void *> pages;
+  for (int i = 0; i < n; ++i) {
+    if (i == pos) {
+      keys.push_back(key);
+      pages.push_back(right);
+    }
+    keys.push_back(r->key(i));
+    pages.push_back(r->page(i));
+  }
+  if (pos == n) {
+    keys.push_back(key);
+    pages.push_back(right);
+  }
+  publish_replicas(level - 1, keys, pages);
+}
+
+// Keep a read-only replica of the top levels internal levels in the memory
+// of every NUMA node, which descents on that node route through, and bind
+// the chunks of pages allocated from now on to the allocating thread's node
+// (slab_numa_local). Splits and new roots update the replicas; 0 drops
+// them. Call it before the tree is shared with other threads.
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+void basic_btree<Key, Value, PageSize, Lock, Persist>::numa_replicate(
+    int levels) {
+  if (levels > 0)
+    slab_globals<>::slab_numa_local = true;
+  replica_levels = levels;
+  rebuild_replicas();
+}
+
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+void basic_btree<Key, Value, PageSize, Lock, Persist>::printAll() {
+  pthread_mutex_lock(&globals::print_mtx);
+  int total_keys = 0;
+  page *leftmost = (page *)root;
+  printf("root: %x\n", page::word(root));
+  do {
+    page *sibling = leftmost;
+    while (sibling) {
+      if (sibling->hdr.level == 0) {
+        total_keys += sibling->hdr.last_index + 1;
+      }
+      sibling->print();
+      sibling = sibling->hdr.sibling_ptr;
+    }
+    printf("-----------------------------------------\n");
+    leftmost = leftmost->hdr.leftmost_ptr;
+  } while (leftmost);
+
+  printf("total number of keys: %d\n", total_keys);
+  pthread_mutex_unlock(&globals::print_mtx);
+}
+
+// scramble the switch_counter of every page, so that searches take both
+// directions
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+void basic_btree<Key, Value, PageSize, Lock, Persist>::randScounter() {
+  page *leftmost = root;
+
+  srand(time(NULL));
+  do {
+    for (page *sibling = leftmost; sibling; sibling = sibling->hdr.sibling_ptr)
+      sibling->hdr.switch_counter = rand() % 100;
+    leftmost = leftmost->hdr.leftmost_ptr;
+  } while (leftmost);
+}
+
+// Reserve the pages of splits ahead on a background thread, see "Page
+// reservations" in reserve.h; stop_reserver() before the pool is closed
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+void basic_btree<Key, Value, PageSize, Lock, Persist>::start_reserver() {
+  Persist::template start_reserver<sizeof(page)>();
+}
+
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+void basic_btree<Key, Value, PageSize, Lock, Persist>::stop_reserver() {
+  Persist::stop_reserver();
+}
+
+/*
+ * Sharded tree
+ * A sharded_btree splits the key space across independent trees, so that
+ * writers to different shards never meet on a root split, an upper-level
+ * insert or the rightmost leaf of an ascending ingest. Shards are chosen by
+ * key range, from num_shards - 1 ascending split keys (shard i holds the
+ * keys in [splits[i - 1], splits[i])), or by a hash of the key. Point
+ * operations go to one shard; a sharded_cursor merges the scans of the
+ * shards that overlap its range.
+ *
+ * A DRAM sharded tree allocates its shards with new. In a pool the sharded
+ * tree is the root object and keeps the partitioning and the shards there,
+ * set up by constructor() and attached to by open(). All shards share the
+ * pool: the pool base and the lock generation are per process, so one
+ * process opens one pool.
+ */
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+class basic_sharded_cursor;
+
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+class basic_sharded_btree {
+  typedef Key entry_key_t;
+  typedef basic_btree<Key, Value, PageSize, Lock, Persist> btree;
+  typedef basic_page<Key, Value, PageSize, Lock, Persist> page;
+  typedef typename Persist::pool_type pool_type;
+
+private:
+  uint32_t num;
+  uint8_t hashed;
+  entry_key_t splits[SHARD_MAX - 1];
+  typename Persist::template link<btree> shards[SHARD_MAX];
+
+  // take num_shards shards, split on the num_shards - 1 ascending keys of
+  // split_keys, or by hash if split_keys is NULL
+  void partition(int num_shards, const entry_key_t *split_keys) {
+    if (num_shards < 1 || num_shards > SHARD_MAX) {
+      fprintf(stderr, "a sharded tree takes 1 to %d shards\n", SHARD_MAX);
+      exit(1);
+    }
+
+    num = num_shards;
+    hashed = split_keys == NULL;
+    for (int i = 0; !hashed && i < num_shards - 1; ++i)
+      splits[i] = split_keys[i];
+  }
+
+public:
+  // range partitioning on num_shards - 1 ascending split keys
+  basic_sharded_btree(const entry_key_t *split_keys, int num_shards) {
+    partition(num_shards, split_keys);
+    for (int i = 0; i < num_shards; ++i)
+      shards[i] = new btree();
+  }
+
+  // hash partitioning
+  explicit basic_sharded_btree(int num_shards) {
+    partition(num_shards, NULL);
+    for (int i = 0; i < num_shards; ++i)
+      shards[i] = new btree();
+  }
+
+  ~basic_sharded_btree() {
+    for (uint32_t i = 0; i < num; ++i)
+      delete (btree *)shards[i];
+  }
+
+  void constructor(pool_type *, int num_shards, const entry_key_t *splits,
+                   bool hybrid = false);
+  void open(pool_type *, int num_threads = 1);
+
+  int num_shards() const { return num; }
+  btree *shard(int i) { return shards[i]; }
+
+  int shard_of(entry_key_t key) const {
+    if (hashed)
+      return (int)((key_hash(key) >> 32) % num);
+    return (int)(std::upper_bound(splits, splits + num - 1, key) - splits);
+  }
+
+  void btree_insert(entry_key_t key, Value value) {
+    shard(shard_of(key))->btree_insert(key, value);
+  }
+  void btree_delete(entry_key_t key) {
+    shard(shard_of(key))->btree_delete(key);
+  }
+  bool btree_update(entry_key_t key, Value value) {
+    return shard(shard_of(key))->btree_update(key, value);
+  }
+  bool btree_upsert(entry_key_t key, Value value) {
+    return shard(shard_of(key))->btree_upsert(key, value);
+  }
+  Value btree_search(entry_key_t key) {
+    return shard(shard_of(key))->btree_search(key);
+  }
+
+  void btree_search_range(entry_key_t min, entry_key_t max,
+                          unsigned long *buf) {
+    basic_sharded_cursor<Key, Value, PageSize, Lock, Persist> cursor(this, min,
+                                                                     max);
+    Value chunk[page::cardinality];
+    int n;
+
+    while ((n = cursor.next(NULL, chunk, page::cardinality)) > 0) {
+      for (int i = 0; i < n; ++i)
+        *buf++ = (unsigned long)chunk[i];
+    }
+  }
+
+  void start_compactor() {
+    for (uint32_t i = 0; i < num; ++i)
+      shard(i)->start_compactor();
+  }
+  void stop_compactor() {
+    for (uint32_t i = 0; i < num; ++i)
+      shard(i)->stop_compactor();
+  }
+  void numa_replicate(int levels = NUMA_REPLICA_LEVELS) {
+    for (uint32_t i = 0; i < num; ++i)
+      shard(i)->numa_replicate(levels);
+  }
+
+  friend class basic_sharded_cursor<Key, Value, PageSize, Lock, Persist>;
+};
+
+// Make num_shards empty shards in the pool, split on the num_shards - 1
+// ascending keys of splits, or by hash if splits is NULL
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+void basic_sharded_btree<Key, Value, PageSize, Lock, Persist>::constructor(
+    pool_type *pop, int num_shards, const entry_key_t *split_keys,
+    bool hybrid) {
+  partition(num_shards, split_keys);
+  Persist::attach(pop, this, hybrid);
+  for (int i = 0; i < num_shards; ++i) {
+    shards[i] = (btree *)Persist::alloc_tree(sizeof(btree));
+    shard(i)->constructor(pop, hybrid);
+  }
+  Persist::persist_tree(this, sizeof(*this));
+}
+
+// Attach to the shards of a pool that has been opened again. The lock
+// generation is one per process, so every shard is first brought up to the
+// newest generation among them and btree::open() then bumps them together.
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+void basic_sharded_btree<Key, Value, PageSize, Lock, Persist>::open(
+    pool_type *pop, int num_threads) {
+  uint32_t generation = 0;
+
+  Persist::attach(pop, this, false);
+  for (uint32_t i = 0; i < num; ++i)
+    generation = std::max(generation, shard(i)->generation);
+
+  for (uint32_t i = 0; i < num; ++i) {
+    btree *t = shard(i);
+    t->generation = generation;
+    t->open(pop, num_threads);
+  }
+}
+
+/*
+ * Sharded scan cursor
+ * Range shards are disjoint and ordered, so they are scanned one after the
+ * other, and a shard's cursor is only opened once the scan reaches it. Hash
+ * shards each hold part of every range: every shard is scanned into a
+ * buffer of SHARD_SCAN_BATCH pairs and the buffers are merged on their
+ * smallest head key.
+ */
+template <typename Key, typename Value, int PageSize, typename Lock,
+          typename Persist>
+class basic_sharded_cursor {
+  typedef Key entry_key_t;
+  typedef basic_sharded_btree<Key, Value, PageSize, Lock, Persist>
+      sharded_btree;
+  typedef basic_cursor<Key, Value, PageSize, Lock, Persist> cursor;
+
+private:
+  struct source {
+    cursor *c;
+    int pos, n;
+    entry_key_t keys[SHARD_SCAN_BATCH];
+    Value values[SHARD_SCAN_BATCH];
+  };
+
+  sharded_btree *st;
+  entry_key_t min, max;
+  std::vector<source> sources; // one per hash shard
+  cursor *range; // shard being scanned when not merging
+  int next_shard, last_shard;
+  long remaining;
+
+  // refill s from its shard; s.n is 0 once the shard is done
+  static void fill(source &s) {
+    s.pos = 0;
+    s.n = s.c->next(s.keys, s.values, SHARD_SCAN_BATCH);
+  }
+
+public:
+  basic_sharded_cursor(sharded_btree *st, entry_key_t min, entry_key_t max,
+                       long limit = LONG_MAX)
+      : st(st), min(min), max(max), range(NULL), next_shard(0),
+        last_shard(-1), remaining(limit) {
+    if (!st->hashed) {
+      next_shard = st->shard_of(min);
+      last_shard = st->shard_of(max);
+      return;
+    }
+
+    sources.resize(st->num);
+    for (size_t i = 0; i < sources.size(); ++i) {
+      sources[i].c = new cursor(st->shard(i), min, max);
+      fill(sources[i]);
+    }
+  }
+
+  ~basic_sharded_cursor() {
+    delete range;
+    for (size_t i = 0; i < sources.size(); ++i)
+      delete sources[i].c;
+  }
+
+  // Copy up to n pairs into out_keys (may be NULL) and out_values and return
+  // how many were copied; 0 means the scan is over
+  int next(entry_key_t *out_keys, Value *out_values, int n) {
+    int copied = 0;
+
+    while (copied < n && remaining > 0) {
+      if (sources.empty()) {
+        if (range == NULL) {
+          if (next_shard > last_shard)
+            break;
+          range = new cursor(st->shard(next_shard++), min, max);
+        }
+        int want = (int)std::min((long)(n - copied), remaining);
+        int c = range->next(out_keys ? out_keys + copied : NULL,
+                            out_values + copied, want);
+        if (c == 0) {
+          delete range;
+          range = NULL;
+        }
+        copied += c;
+        remaining -= c;
+        continue;
+      }
+
+      source *m = NULL;
+      for (size_t i = 0; i < sources.size(); ++i) {
+        source &s = sources[i];
+        if (s.pos < s.n && (!m || s.keys[s.pos] < m->keys[m->pos]))
+          m = &s;
+      }
+      if (!m)
+        break;
+
+      if (out_keys)
+        out_keys[copied] = m->keys[m->pos];
+      out_values[copied++] = m->values[m->pos++];
+      --remaining;
+      if (m->pos == m->n)
+        fill(*m);
+    }
+    return copied;
+  }
+};
+
+#endif
@@ -0,0 +1,334 @@
+/*
+ * Pages in DRAM or on a DAX mapping
+ * The DAX pool backend and the persistence policies of the DRAM trees,
+ * which the tree core in btree.h takes as its Persist parameter.
+ */
+#ifndef FAST_FAIR_DAX_H
+#define FAST_FAIR_DAX_H
+
+#include <algorithm>
+#include <fcntl.h>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ebr.h"
+#include "lock.h"
+#include "persist.h"
+#include "slab.h"
+
+/*
+ * DAX backend
+ * A dax_pool maps a file, meant to sit on a DAX file system, and while it
+ * is open every page is taken from it, so a btree(pool) over it survives a
+ * restart. The tree over it takes dram_persist below: it follows plain
+ * pointers and flushes with clflush(). The file is always mapped at the
+ * address it was created at, dax_pool::dax_base unless changed, which keeps
+ * the pointers stored in it valid; open() fails if the range is taken. With
+ * MAP_SYNC a flushed line is durable; on a file system without DAX the
+ * mapping is a plain shared one, which survives a process crash, and close()
+ * syncs it. One pool is open at a time and holds one tree.
+ *
+ * The allocator only appends: a thread claims DAX_CHUNK_PAGES pages at a
+ * time by moving the persistent end mark, so a crash between the claim and
+ * the link of a page leaks it but never hands it out twice. Freed pages are
+ * reused within the session and chained for the next one by close(); after
+ * a crash they are leaked with the rest of each thread's chunk.
+ */
+#define DAX_MAGIC "FFDAXPL"
+#define DAX_VERSION 1
+#define DAX_HEADER_SIZE 4096
+#define DAX_CHUNK_PAGES 64
+
+#ifndef MAP_SHARED_VALIDATE
+#define MAP_SHARED_VALIDATE 0x03
+#endif
+#ifndef MAP_SYNC
+#define MAP_SYNC 0x80000
+#endif
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+template <typename T = void> class basic_dax_pool {
+  struct header {
+    char magic[8]; // DAX_MAGIC with its NUL
+    uint32_t version;
+    uint32_t block_size; // page size, 0 until a tree is set up
+    uint64_t base;       // address the file is mapped at
+    uint64_t size;
+    uint64_t end;       // offset of the first unclaimed byte
+    uint64_t root;      // root page of the tree, 0 for none
+    uint64_t free_list; // pages freed before the last close()
+    uint32_t generation;
+  };
+
+  struct free_block {
+    free_block *next;
+  };
+
+  struct chunk {
+    uint64_t session; // the pool open the chunk was claimed in
+    char *cur, *end;
+  };
+
+  header *hdr;
+  int fd;
+  bool sync; // mapped with MAP_SYNC
+  uint64_t session;
+  std::mutex free_mtx;
+  free_block *free_head;
+
+  static thread_local chunk cache;
+  static uint64_t sessions;
+
+  basic_dax_pool() : hdr(NULL), fd(-1), sync(false), free_head(NULL) {}
+
+  // Map size bytes of fd at base. Returns false if the range is taken.
+  bool map(uint64_t base, uint64_t size) {
+    void *p = mmap((void *)base, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED_VALIDATE | MAP_SYNC | MAP_FIXED_NOREPLACE, fd, 0);
+    sync = p != MAP_FAILED;
+    if (!sync) // no DAX here
+      p = mmap((void *)base, size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+    if (p == MAP_FAILED)
+      return false;
+    if (p != (void *)base) { // a kernel without MAP_FIXED_NOREPLACE
+      munmap(p, size);
+      return false;
+    }
+    hdr = (header *)p;
+    return true;
+  }
+
+  void attach() {
+    uint32_t &generation = lock_globals<>::lock_generation;
+
+    generation = std::max(hdr->generation, generation) + 1;
+    hdr->generation = generation;
+    free_head = (free_block *)hdr->free_list;
+    hdr->free_list = 0;
+    clflush((char *)hdr, sizeof(header));
+    session = ++sessions;
+    active = this;
+  }
+
+public:
+  static basic_dax_pool *active; // the open pool, NULL for none
+  static uint64_t dax_base;      // where create() maps a new pool
+
+  // Create a pool of size bytes at path, which must not exist yet
+  static basic_dax_pool *create(const char *path, uint64_t size) {
+    basic_dax_pool *pool = new basic_dax_pool();
+
+    size = (size + DAX_HEADER_SIZE - 1) & ~(uint64_t)(DAX_HEADER_SIZE - 1);
+    pool->fd = ::open(path, O_RDWR | O_CREAT | O_EXCL, 0666);
+    if (pool->fd < 0 || ftruncate(pool->fd, size) != 0 ||
+        !pool->map(dax_base, size)) {
+      perror(path);
+      if (pool->fd >= 0) {
+        ::close(pool->fd);
+        unlink(path);
+      }
+      delete pool;
+      return NULL;
+    }
+
+    header *h = pool->hdr;
+    memcpy(h->magic, DAX_MAGIC, sizeof(h->magic));
+    h->version = DAX_VERSION;
+    h->base = dax_base;
+    h->size = size;
+    h->end = DAX_HEADER_SIZE;
+    h->generation = lock_globals<>::lock_generation;
+    pool->attach();
+    return pool;
+  }
+
+  // Open the pool at path. Returns NULL if it cannot be read, is not a pool
+  // or cannot be mapped at its address.
+  static basic_dax_pool *open(const char *path) {
+    basic_dax_pool *pool = new basic_dax_pool();
+    header h;
+
+    pool->fd = ::open(path, O_RDWR);
+    if (pool->fd < 0 || pread(pool->fd, &h, sizeof(h), 0) != sizeof(h) ||
+        memcmp(h.magic, DAX_MAGIC, sizeof(h.magic)) != 0 ||
+        h.version != DAX_VERSION || !pool->map(h.base, h.size)) {
+      fprintf(stderr, "cannot open the DAX pool %s\n", path);
+      if (pool->fd >= 0)
+        ::close(pool->fd);
+      delete pool;
+      return NULL;
+    }
+    pool->attach();
+    return pool;
+  }
+
+  // Unmap the pool and delete it. The tree's threads must have finished;
+  // the pages they retired are freed into the pool first.
+  void close() {
+    for (int i = 0; i < 3; ++i)
+      ebr::reclaim();
+
+    for (free_block *b = free_head; b; b = b->next)
+      clflush_nofence((char *)&b->next, sizeof(free_block *));
+    persist_fence();
+    hdr->free_list = (uint64_t)free_head;
+    clflush((char *)&hdr->free_list, sizeof(uint64_t));
+    if (!sync)
+      msync(hdr, hdr->size, MS_SYNC);
+
+    active = NULL;
+    munmap(hdr, hdr->size);
+    ::close(fd);
+    delete this;
+  }
+
+  bool contains(const void *p) const {
+    return (uint64_t)p >= hdr->base && (uint64_t)p < hdr->base + hdr->size;
+  }
+
+  // Record the page size of the tree, or check it against the recorded one
+  bool format(uint32_t block_size) {
+    if (hdr->block_size == 0) {
+      hdr->block_size = block_size;
+      clflush((char *)&hdr->block_size, sizeof(uint32_t));
+    }
+    return hdr->block_size == block_size;
+  }
+
+  char *root() const { return (char *)hdr->root; }
+
+  void set_root(char *root) {
+    hdr->root = (uint64_t)root;
+    clflush((char *)&hdr->root, sizeof(uint64_t));
+  }
+
+  void *alloc() {
+    chunk &c = cache;
+
+    if (__atomic_load_n(&free_head, __ATOMIC_RELAXED)) {
+      std::lock_guard<std::mutex> guard(free_mtx);
+      if (free_block *b = free_head) {
+        free_head = b->next;
+        return b;
+      }
+    }
+
+    if (c.session != session || c.cur + hdr->block_size > c.end) {
+      uint64_t len = (uint64_t)DAX_CHUNK_PAGES * hdr->block_size;
+      uint64_t off = __atomic_fetch_add(&hdr->end, len, __ATOMIC_RELAXED);
+
+      if (off + len > hdr->size) {
+        fprintf(stderr, "the DAX pool is full\n");
+        exit(1);
+      }
+      // the line holds an end at least as far as ours when it is written
+      clflush((char *)&hdr->end, sizeof(uint64_t));
+      c.session = session;
+      c.cur = (char *)hdr->base + off;
+      c.end = c.cur + len;
+    }
+
+    void *ret = c.cur;
+    c.cur += hdr->block_size;
+    return ret;
+  }
+
+  void free(void *p) {
+    free_block *b = (free_block *)p;
+    std::lock_guard<std::mutex> guard(free_mtx);
+    b->next = free_head;
+    free_head = b;
+  }
+};
+
+typedef basic_dax_pool<> dax_pool;
+
+template <typename T>
+thread_local typename basic_dax_pool<T>::chunk basic_dax_pool<T>::cache;
+template <typename T> uint64_t basic_dax_pool<T>::sessions = 0;
+template <typename T> basic_dax_pool<T> *basic_dax_pool<T>::active = NULL;
+// 16TB, clear of heap and libraries
+template <typename T>
+uint64_t basic_dax_pool<T>::dax_base = 0x100000000000UL;
+
+/*
+ * Persistence policies
+ * dram_persist links pages with plain pointers, writes them back with
+ * clflush() and takes them from the open dax_pool, or from the slab
+ * allocator while none is open. no_persist (make PERSIST=none) is the same
+ * without a single write-back or fence, which gives the same tree as a
+ * volatile index and shows what the flushes cost. The level of the page
+ * that every call gets is what the PMDK policy in pmem.h keys hybrid mode
+ * on; these ignore it.
+ */
+struct dram_persist {
+  template <typename T> using link = T *;
+  typedef dax_pool pool_type;
+
+  // a page as the records of its parent hold it, and back
+  static char *word(const void *p) { return (char *)p; }
+  template <typename T> static T *at(const char *w) { return (T *)w; }
+
+  static bool volatile_level(uint32_t) { return false; }
+
+  static void persist(uint32_t, const void *addr, size_t len) {
+    clflush((char *)addr, len);
+  }
+  static void persist_flush(uint32_t, const void *addr, size_t len) {
+    clflush_nofence((char *)addr, len);
+  }
+  static void persist_drain(uint32_t) { persist_fence(); }
+
+  // a field of the tree object
+  static void persist_tree(const void *addr, size_t len) {
+    clflush((char *)addr, len);
+  }
+
+  // make page the root of the tree, and of the open pool if it has one
+  template <typename T>
+  static void set_root(pool_type *pool, link<T> &root, T *page, uint32_t) {
+    root = page;
+    clflush((char *)&root, sizeof(root));
+    if (pool)
+      pool->set_root((char *)page);
+  }
+
+  static void emulate_read() { emulate_read_latency(); }
+
+  template <size_t Size> static void *alloc_page(uint32_t) {
+    if (dax_pool::active)
+      return dax_pool::active->alloc();
+    return slab_allocator<Size>::alloc();
+  }
+
+  template <size_t Size> static void free_page(void *p, uint32_t) {
+    if (dax_pool::active && dax_pool::active->contains(p))
+      dax_pool::active->free(p);
+    else
+      slab_allocator<Size>::free(p);
+  }
+};
+
+struct no_persist : dram_persist {
+  static void persist(uint32_t, const void *, size_t) {}
+  static void persist_flush(uint32_t, const void *, size_t) {}
+  static void persist_drain(uint32_t) {}
+  static void persist_tree(const void *, size_t) {}
+
+  template <typename T>
+  static void set_root(pool_type *pool, link<T> &root, T *page, uint32_t) {
+    root = page;
+    if (pool)
+      pool->set_root((char *)page);
+  }
+};
+
+#endif
@@ -0,0 +1,161 @@
+/*
+ * Epoch-based reclamation
+ * A page that remove_rebalancing() unlinks may still be under a lock-free
+ * reader, so it is retired rather than freed. Every tree operation runs
+ * inside an epoch_guard, which publishes the global epoch in the thread's
+ * slot while it is in the tree. The global epoch only moves on once every
+ * thread in the tree has seen it, so a page retired in epoch e is out of
+ * reach of all guards once the epoch reaches e + 2 and goes back to its
+ * allocator then. Each thread keeps its own limbo list and tries to advance
+ * every EBR_RECLAIM_BATCH retirements; a thread that exits hands what is
+ * left to a shared list. The lists are in DRAM, so on a PMDK pool pages
+ * still waiting in them when the process dies stay allocated in the pool.
+ */
+#ifndef FAST_FAIR_EBR_H
+#define FAST_FAIR_EBR_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "util.h"
+
+#define EBR_MAX_THREADS 256
+#define EBR_RECLAIM_BATCH 64
+
+template <typename T = void> class basic_ebr {
+  struct alignas(CACHE_LINE_SIZE) slot {
+    std::atomic<uint64_t> epoch; // 0 while the thread is outside the tree
+    std::atomic<bool> used;
+  };
+
+  struct retired {
+    void *ptr;
+    void (*release)(void *);
+    uint64_t epoch;
+  };
+
+  struct thread_state {
+    int slot_id, depth;
+    std::vector<retired> limbo;
+
+    thread_state() : slot_id(-1), depth(0) {}
+
+    ~thread_state() {
+      if (!limbo.empty()) {
+        std::lock_guard<std::mutex> guard(shared_mtx);
+        shared_limbo.insert(shared_limbo.end(), limbo.begin(), limbo.end());
+      }
+      if (slot_id >= 0)
+        slots[slot_id].used.store(false);
+    }
+  };
+
+  static slot slots[EBR_MAX_THREADS];
+  static thread_local thread_state state;
+  static std::atomic<uint64_t> global_epoch;
+  static std::mutex shared_mtx;
+  static std::vector<retired> shared_limbo;
+
+  static int claim_slot() {
+    for (int i = 0; i < EBR_MAX_THREADS; ++i) {
+      bool expected = false;
+      if (slots[i].used.compare_exchange_strong(expected, true))
+        return i;
+    }
+    fprintf(stderr, "more than %d threads in the tree\n", EBR_MAX_THREADS);
+    exit(1);
+  }
+
+  // Move the global epoch on if every thread in the tree has seen it
+  static uint64_t try_advance() {
+    uint64_t e = global_epoch.load();
+
+    for (int i = 0; i < EBR_MAX_THREADS; ++i) {
+      uint64_t t = slots[i].epoch.load();
+      if (t != 0 && t != e)
+        return e;
+    }
+    global_epoch.compare_exchange_strong(e, e + 1);
+    return global_epoch.load();
+  }
+
+  static void release(std::vector<retired> &list, uint64_t e) {
+    size_t n = 0;
+
+    for (size_t i = 0; i < list.size(); ++i) {
+      if (list[i].epoch + 2 <= e)
+        list[i].release(list[i].ptr);
+      else
+        list[n++] = list[i];
+    }
+    list.resize(n);
+  }
+
+public:
+  // Guards nest; only the outermost one publishes the epoch
+  static void enter() {
+    thread_state &s = state;
+
+    if (s.depth++ > 0)
+      return;
+    if (s.slot_id < 0)
+      s.slot_id = claim_slot();
+    // seq_cst orders the publication before any read of a page
+    slots[s.slot_id].epoch.store(global_epoch.load());
+  }
+
+  // the epoch that the calling thread's outermost guard published
+  static uint64_t pinned() {
+    return slots[state.slot_id].epoch.load(std::memory_order_relaxed);
+  }
+
+  static void leave() {
+    thread_state &s = state;
+
+    if (--s.depth == 0)
+      slots[s.slot_id].epoch.store(0, std::memory_order_release);
+  }
+
+  // Hand ptr to release() once no guard can reach it any more
+  static void retire(void *ptr, void (*release)(void *)) {
+    thread_state &s = state;
+    retired r = {ptr, release, global_epoch.load()};
+
+    s.limbo.push_back(r);
+    if (s.limbo.size() % EBR_RECLAIM_BATCH == 0)
+      reclaim();
+  }
+
+  static void reclaim() {
+    uint64_t e = try_advance();
+
+    release(state.limbo, e);
+    std::lock_guard<std::mutex> guard(shared_mtx);
+    release(shared_limbo, e);
+  }
+};
+
+typedef basic_ebr<> ebr;
+
+template <typename T>
+typename basic_ebr<T>::slot basic_ebr<T>::slots[EBR_MAX_THREADS];
+template <typename T>
+thread_local typename basic_ebr<T>::thread_state basic_ebr<T>::state;
+template <typename T>
+std::atomic<uint64_t> basic_ebr<T>::global_epoch(1);
+template <typename T>
+std::mutex basic_ebr<T>::shared_mtx;
+template <typename T>
+std::vector<typename basic_ebr<T>::retired> basic_ebr<T>::shared_limbo;
+
+class epoch_guard {
+public:
+  epoch_guard() { ebr::enter(); }
+  ~epoch_guard() { ebr::leave(); }
+
+  epoch_guard(const epoch_guard &) = delete;
+  epoch_guard &operator=(const epoch_guard &) = delete;
+};
+
+#endif
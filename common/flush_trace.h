@@ -0,0 +1,173 @@
+/*
+ * Flush tracing
+ * Built with -DFLUSH_TRACE (make TRACE=1), every cache line written back
+ * (clflush_nofence(), or pmemobj_persist() and pmemobj_flush() on a pool)
+ * and every fence or drain is charged to the innermost flush_site of the
+ * calling thread and to the tree operation (flush_op) it runs. A line
+ * written back again within one operation counts as a duplicate.
+ * flush_trace::report() prints the totals per site and per operation.
+ * Without the flag the scopes are empty and nothing is recorded.
+ */
+#ifndef FAST_FAIR_FLUSH_TRACE_H
+#define FAST_FAIR_FLUSH_TRACE_H
+
+#include <algorithm>
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+enum flush_site_id {
+  SITE_OTHER,      // allocators, constructors and unscoped callers
+  SITE_INSERT_KEY, // FAST shifts of page::insert_key, unsorted slot writes
+  SITE_REMOVE_KEY, // FAST shifts of page::remove_key
+  SITE_SPLIT,      // FAIR splits in page::store
+  SITE_MERGE,      // root collapses, merges and redistributions
+  SITE_NEW_ROOT,   // btree::setNewRoot
+  SITE_UPDATE,     // in-place value stores of btree_update
+  SITE_BULK_LOAD,  // pages written by btree_bulk_load
+  SITE_NUM
+};
+
+enum flush_op_id {
+  FLUSH_OP_NONE, // flushes outside btree_insert, btree_delete and btree_update
+  FLUSH_OP_INSERT,
+  FLUSH_OP_DELETE,
+  FLUSH_OP_UPDATE, // btree_update and btree_upsert
+  FLUSH_OP_NUM
+};
+
+#ifdef FLUSH_TRACE
+template <typename T = void> class basic_flush_trace {
+  struct counts {
+    std::atomic<unsigned long long> lines, bytes, dup_lines, fences, ops;
+  };
+
+  static thread_local int site, op;
+  static thread_local std::vector<uint64_t> op_lines; // lines of this op
+  static counts sites[SITE_NUM], ops[FLUSH_OP_NUM];
+
+  static void add(counts &c, unsigned long long lines, unsigned long long bytes,
+                  unsigned long long dup_lines, unsigned long long fences) {
+    c.lines += lines;
+    c.bytes += bytes;
+    c.dup_lines += dup_lines;
+    c.fences += fences;
+  }
+
+  friend struct flush_site;
+  friend struct flush_op;
+
+public:
+  // charge a write-back of [addr, addr + len)
+  static void flush(const void *addr, size_t len) {
+    uint64_t first = (uint64_t)addr / CACHE_LINE_SIZE;
+    uint64_t last = ((uint64_t)addr + len - 1) / CACHE_LINE_SIZE;
+    unsigned long long dup_lines = 0;
+
+    if (op != FLUSH_OP_NONE) {
+      for (uint64_t line = first; line <= last; ++line) {
+        if (std::find(op_lines.begin(), op_lines.end(), line) !=
+            op_lines.end())
+          ++dup_lines;
+        else
+          op_lines.push_back(line);
+      }
+    }
+    add(sites[site], last - first + 1, len, dup_lines, 0);
+    add(ops[op], last - first + 1, len, dup_lines, 0);
+  }
+
+  static void fence() {
+    add(sites[site], 0, 0, 0, 1);
+    add(ops[op], 0, 0, 0, 1);
+  }
+
+  static void report(FILE *out) {
+    static const char *site_names[SITE_NUM] = {
+        "other", "insert_key", "remove_key", "split",
+        "merge", "new_root",   "update",     "bulk_load"};
+    static const char *op_names[FLUSH_OP_NUM] = {"none", "insert", "delete",
+                                           "update"};
+
+    fprintf(out, "%-12s %12s %14s %12s %12s\n", "flush site", "lines", "bytes",
+            "dup_lines", "fences");
+    for (int s = 0; s < SITE_NUM; ++s)
+      fprintf(out, "%-12s %12llu %14llu %12llu %12llu\n", site_names[s],
+              sites[s].lines.load(), sites[s].bytes.load(),
+              sites[s].dup_lines.load(), sites[s].fences.load());
+
+    // per operation means; writes outside an operation are only summed
+    fprintf(out, "%-12s %12s %14s %12s %12s %12s\n", "flush op", "ops",
+            "lines/op", "bytes/op", "dup/op", "fences/op");
+    for (int o = 0; o < FLUSH_OP_NUM; ++o) {
+      unsigned long long n = o == FLUSH_OP_NONE ? 1 : ops[o].ops.load();
+      if (n == 0)
+        continue;
+      fprintf(out, "%-12s %12llu %14.2f %12.2f %12.2f %12.2f\n", op_names[o],
+              ops[o].ops.load(), (double)ops[o].lines / n,
+              (double)ops[o].bytes / n, (double)ops[o].dup_lines / n,
+              (double)ops[o].fences / n);
+    }
+  }
+};
+
+typedef basic_flush_trace<> flush_trace;
+
+template <typename T>
+thread_local int basic_flush_trace<T>::site = SITE_OTHER;
+template <typename T>
+thread_local int basic_flush_trace<T>::op = FLUSH_OP_NONE;
+template <typename T>
+thread_local std::vector<uint64_t> basic_flush_trace<T>::op_lines;
+template <typename T>
+typename basic_flush_trace<T>::counts
+    basic_flush_trace<T>::sites[SITE_NUM];
+template <typename T>
+typename basic_flush_trace<T>::counts
+    basic_flush_trace<T>::ops[FLUSH_OP_NUM];
+
+// charges the flushes of its lifetime to a call site
+struct flush_site {
+  int saved;
+
+  explicit flush_site(int s) : saved(flush_trace::site) {
+    flush_trace::site = s;
+  }
+  ~flush_site() { flush_trace::site = saved; }
+};
+
+// charges the flushes of its lifetime to one operation, unless the thread
+// already runs one (an upsert that inserts stays an update)
+struct flush_op {
+  bool outer;
+
+  explicit flush_op(int o) : outer(flush_trace::op == FLUSH_OP_NONE) {
+    if (outer) {
+      flush_trace::op = o;
+      flush_trace::op_lines.clear();
+      ++flush_trace::ops[o].ops;
+    }
+  }
+  ~flush_op() {
+    if (outer)
+      flush_trace::op = FLUSH_OP_NONE;
+  }
+};
+#else
+struct flush_trace {
+  static inline void flush(const void *, size_t) {}
+  static inline void fence() {}
+  static inline void report(FILE *) {}
+};
+
+struct flush_site {
+  explicit flush_site(int) {}
+};
+
+struct flush_op {
+  explicit flush_op(int) {}
+};
+#endif
+
+#endif
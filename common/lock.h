@@ -0,0 +1,295 @@
+/*
+ * Locking policies
+ * The tree core in btree.h takes one of these as its Lock parameter:
+ *
+ *   no_locks       one thread at a time. Pages are freed as soon as they
+ *                  are unlinked, deletes rebalance on the spot, and the
+ *                  lock calls compile to nothing.
+ *   version_locks  writers take the version lock in the page header and
+ *                  readers take nothing; they rely on the switch_counter
+ *                  retry and the duplicate-pointer check, and on the lock
+ *                  word as a version where a page cannot be read that way.
+ *   mutex_locks    as version_locks, but writers block on a pthread mutex.
+ *   rw_locks       writers take a pthread rwlock and the readers of sorted
+ *                  leaves share it.
+ *
+ * The concurrent policies retire unlinked pages through EBR (ebr.h), leave
+ * the merges to the compactor and run every operation in an epoch_guard.
+ * A policy also says whether its lock can be elided with RTM (rtm.h) and
+ * whether a page lock survives a restart of the process: the mutex and the
+ * rwlock live in DRAM and the header only holds a pointer to them.
+ */
+#ifndef FAST_FAIR_LOCK_H
+#define FAST_FAIR_LOCK_H
+
+#include <atomic>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ebr.h"
+#include "util.h"
+
+/*
+ * Version lock
+ * An 8-byte lock word that lives in the page header. Bit 0 is the writer
+ * lock and the next 31 bits count finished write sections, so the same word
+ * serves as a version for optimistic readers: read_begin() waits out a
+ * writer and returns the version, and validate() tells whether a writer got
+ * in since. Contended writers back off exponentially up to LOCK_MAX_BACKOFF
+ * pause instructions between attempts and then yield the CPU.
+ *
+ * The top 32 bits hold the lock generation the word was written in. A page
+ * of a DAX pool or a PMDK pool may still say locked by a writer that is gone
+ * when the pool is opened again; opening the pool bumps the generation, and
+ * a word from an older generation counts as free and is claimed fresh by
+ * the first writer, so no page has to be visited at restart.
+ */
+#ifndef LOCK_MAX_BACKOFF
+#define LOCK_MAX_BACKOFF 1024
+#endif
+
+template <typename T = void> struct lock_globals {
+  static uint32_t lock_generation; // generation of the open pool
+};
+
+template <typename T> uint32_t lock_globals<T>::lock_generation = 1;
+
+class version_lock {
+private:
+  uint64_t word;
+
+  static uint64_t current() {
+    return (uint64_t)lock_globals<>::lock_generation << 32;
+  }
+  static bool stale(uint64_t v) {
+    return (v >> 32) != lock_globals<>::lock_generation;
+  }
+
+public:
+  version_lock() : word(current()) {}
+
+  void destroy() {}
+
+  void lock() {
+    int backoff = 1;
+
+    while (!try_lock()) {
+      if (backoff < LOCK_MAX_BACKOFF) {
+        for (int i = 0; i < backoff; ++i)
+          cpu_pause();
+        backoff <<= 1;
+      } else {
+        // the holder is likely descheduled
+        sched_yield();
+      }
+    }
+  }
+
+  bool try_lock() {
+    uint64_t v = __atomic_load_n(&word, __ATOMIC_RELAXED);
+    if (stale(v))
+      return __sync_bool_compare_and_swap(&word, v, current() | 1);
+    return !(v & 1) && __sync_bool_compare_and_swap(&word, v, v + 1);
+  }
+
+  void unlock() {
+    uint64_t v = (word + 1) & 0xFFFFFFFFULL; // keep a wrap out of the tag
+    __atomic_store_n(&word, current() | v, __ATOMIC_RELEASE);
+  }
+
+  uint64_t read_begin() const {
+    uint64_t v;
+    while (((v = __atomic_load_n(&word, __ATOMIC_ACQUIRE)) & 1) && !stale(v))
+      cpu_pause();
+    return v;
+  }
+
+  bool validate(uint64_t v) const {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&word, __ATOMIC_RELAXED) == v;
+  }
+
+  // whether a writer holds the lock; in a transaction that elides the lock
+  // this puts the word in its read set, so taking the lock aborts it
+  bool is_locked() const {
+    uint64_t v = __atomic_load_n(&word, __ATOMIC_RELAXED);
+    return (v & 1) && !stale(v);
+  }
+
+  // readers of sorted leaves take nothing
+  void read_lock() {}
+  void read_unlock() {}
+};
+
+/*
+ * Blocking locks
+ * A pthread mutex or rwlock in DRAM, pointed to from the header, taken in
+ * front of a version lock next to it. The version lock is only taken by the
+ * holder of the pthread lock, so it never spins; it keeps read_begin() and
+ * validate() working for the readers that validate instead of locking. The
+ * header holds the pointer alone, so a page keeps the size it has with a
+ * version lock.
+ */
+template <typename T> class blocking_lock {
+protected:
+  struct state {
+    T lock;
+    version_lock version;
+  } *s;
+
+  blocking_lock() : s(new state) {}
+
+public:
+  uint64_t read_begin() const { return s->version.read_begin(); }
+  bool validate(uint64_t v) const { return s->version.validate(v); }
+  bool is_locked() const { return s->version.is_locked(); }
+
+  void read_lock() {}
+  void read_unlock() {}
+};
+
+class mutex_lock : public blocking_lock<pthread_mutex_t> {
+public:
+  mutex_lock() {
+    if (pthread_mutex_init(&s->lock, NULL)) {
+      perror("lock init fail");
+      exit(1);
+    }
+  }
+
+  void destroy() {
+    pthread_mutex_destroy(&s->lock);
+    delete s;
+  }
+
+  void lock() {
+    pthread_mutex_lock(&s->lock);
+    s->version.lock();
+  }
+
+  bool try_lock() {
+    if (pthread_mutex_trylock(&s->lock))
+      return false;
+    s->version.lock();
+    return true;
+  }
+
+  void unlock() {
+    s->version.unlock();
+    pthread_mutex_unlock(&s->lock);
+  }
+};
+
+class rw_lock : public blocking_lock<pthread_rwlock_t> {
+public:
+  rw_lock() {
+    if (pthread_rwlock_init(&s->lock, NULL)) {
+      perror("lock init fail");
+      exit(1);
+    }
+  }
+
+  void destroy() {
+    pthread_rwlock_destroy(&s->lock);
+    delete s;
+  }
+
+  void lock() {
+    pthread_rwlock_wrlock(&s->lock);
+    s->version.lock();
+  }
+
+  bool try_lock() {
+    if (pthread_rwlock_trywrlock(&s->lock))
+      return false;
+    s->version.lock();
+    return true;
+  }
+
+  void unlock() {
+    s->version.unlock();
+    pthread_rwlock_unlock(&s->lock);
+  }
+
+  void read_lock() { pthread_rwlock_rdlock(&s->lock); }
+  void read_unlock() { pthread_rwlock_unlock(&s->lock); }
+};
+
+struct no_locks {
+  static const bool concurrent = false;
+  static const bool elidable = false;
+  static const bool durable = true;
+
+  class page_lock {
+  public:
+    void destroy() {}
+    void lock() {}
+    bool try_lock() { return true; }
+    void unlock() {}
+    uint64_t read_begin() const { return 0; }
+    bool validate(uint64_t) const { return true; }
+    bool is_locked() const { return false; }
+    void read_lock() {}
+    void read_unlock() {}
+  };
+
+  class guard {
+  public:
+    guard() {}
+  };
+
+  // pages freed so far, which tells a leaf hint whether its leaf is gone
+  static std::atomic<uint64_t> &pages_freed() {
+    static std::atomic<uint64_t> freed(0);
+    return freed;
+  }
+
+  static void retire(void *p, void (*release)(void *)) { release(p); }
+  static void reclaim() {}
+  static void released() {
+    pages_freed().fetch_add(1, std::memory_order_relaxed);
+  }
+  static uint64_t stamp() {
+    return pages_freed().load(std::memory_order_relaxed);
+  }
+};
+
+// what the concurrent policies share: a leaf hint lasts for its epoch
+struct epoch_locks {
+  static const bool concurrent = true;
+
+  typedef epoch_guard guard;
+
+  static void retire(void *p, void (*release)(void *)) {
+    ebr::retire(p, release);
+  }
+  static void reclaim() { ebr::reclaim(); }
+  static void released() {}
+  static uint64_t stamp() { return ebr::pinned(); }
+};
+
+struct version_locks : epoch_locks {
+  static const bool elidable = true;
+  static const bool durable = true;
+
+  typedef version_lock page_lock;
+};
+
+struct mutex_locks : epoch_locks {
+  static const bool elidable = false;
+  static const bool durable = false;
+
+  typedef mutex_lock page_lock;
+};
+
+struct rw_locks : epoch_locks {
+  static const bool elidable = false;
+  static const bool durable = false;
+
+  typedef rw_lock page_lock;
+};
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * NUMA placement
+ * numa_bind() asks the kernel to back a mapping from one node, as the slab
+ * allocator does with the chunks of slab_numa_local. A numa_replica is a
+ * read-only copy of the top levels of a tree in memory of one node: the
+ * pages one level below them, sorted, with a key at or above the lowest key
+ * each one may hold. A descent routes its key through the replica of its
+ * thread's node instead of reading the top levels, which every socket
+ * shares, and a replica that misses a newer page only sends the descent
+ * one sibling hop further.
+ */
+#ifndef FAST_FAIR_NUMA_H
+#define FAST_FAIR_NUMA_H
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define NUMA_MAX_NODES 16 // nodes with a replica of their own; others share
+
+#ifndef NUMA_REPLICA_LEVELS
+#define NUMA_REPLICA_LEVELS 2 // top internal levels a replica stands in for
+#endif
+
+// the node the calling thread runs on now, -1 if the kernel does not tell
+inline int numa_current_node() {
+  unsigned cpu, node;
+
+  if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+    return -1;
+  return (int)node;
+}
+
+// The node of the calling thread, looked up once per thread: a thread that
+// migrates keeps its first node, so pin the threads that use replicas
+inline int numa_node() {
+  static thread_local int node = -1;
+
+  if (node < 0)
+    node = std::max(numa_current_node(), 0) % NUMA_MAX_NODES;
+  return node;
+}
+
+// the number of nodes the system may have, at most NUMA_MAX_NODES
+inline int numa_nodes() {
+  static int nodes = 0;
+
+  if (nodes == 0) {
+    FILE *f = fopen("/sys/devices/system/node/possible", "r");
+    int first = 0, last = 0;
+
+    // the file holds a range such as "0-3", or "0" on one node
+    if (f) {
+      int n = fscanf(f, "%d-%d", &first, &last);
+      if (n == 1)
+        last = first;
+      fclose(f);
+    }
+    nodes = std::min(std::max(last + 1, 1), NUMA_MAX_NODES);
+  }
+  return nodes;
+}
+
+// prefer node for the pages of [addr, addr + len), which must be untouched
+inline void numa_bind(void *addr, size_t len, int node) {
+  const int mpol_preferred = 1; // MPOL_PREFERRED in <numaif.h>
+  unsigned long mask[16] = {0};
+
+  if (node < 0 || node >= (int)sizeof(mask) * 8)
+    return;
+  mask[node / 64] |= 1UL << (node % 64);
+  syscall(SYS_mbind, addr, len, mpol_preferred, mask, sizeof(mask) * 8, 0);
+}
+
+template <typename Key> class numa_replica {
+  size_t bytes; // of the mapping
+  int n;
+  uint32_t level; // of the pages
+  Key *keys;      // keys[i] for i > 0 is at or above the low key of pages[i]
+  void **pages;
+
+public:
+  // A replica in memory of node routing to pages[0..n-1] at level, with
+  // keys as above; NULL if n is 0
+  static numa_replica *create(int node, uint32_t level, const Key *keys,
+                              void *const *pages, int n) {
+    if (n == 0)
+      return NULL;
+
+    size_t keys_at = (sizeof(numa_replica) + 7) & ~7UL;
+    size_t pages_at = (keys_at + n * sizeof(Key) + 7) & ~7UL;
+    size_t bytes = pages_at + n * sizeof(void *);
+    char *p = (char *)mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+      perror("replica mmap fail");
+      exit(1);
+    }
+    numa_bind(p, bytes, node);
+
+    numa_replica *r = (numa_replica *)p;
+    r->bytes = bytes;
+    r->n = n;
+    r->level = level;
+    r->keys = (Key *)(p + keys_at);
+    r->pages = (void **)(p + pages_at);
+    std::copy(keys, keys + n, r->keys);
+    std::copy(pages, pages + n, r->pages);
+    return r;
+  }
+
+  // frees a replica handed to ebr::retire()
+  static void release(void *p) { munmap(p, ((numa_replica *)p)->bytes); }
+
+  int size() const { return n; }
+  uint32_t page_level() const { return level; }
+  const Key &key(int i) const { return keys[i]; }
+  void *page(int i) const { return pages[i]; }
+
+  // the last page whose key is at or below key, the first one if none is
+  void *route(const Key &key) const {
+    return pages[std::upper_bound(keys + 1, keys + n, key) - keys - 1];
+  }
+};
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * Persistence for pages in DRAM or on a DAX mapping
+ * NVM latency emulation and the cache line write-back backend, which the
+ * policies of dax.h flush the pages with.
+ */
+#ifndef FAST_FAIR_PERSIST_H
+#define FAST_FAIR_PERSIST_H
+
+#include <cpuid.h>
+#include <time.h>
+
+#include "flush_trace.h"
+#include "stats.h"
+#include "util.h"
+
+// the latencies to emulate and the write-back instruction in use
+template <typename T = void> struct persist_globals {
+  static unsigned long cpu_freq_mhz;
+  static unsigned long write_latency_in_ns, read_latency_in_ns;
+  static int flush_type;
+};
+
+/*
+ * NVM latency emulation
+ * The TSC frequency is calibrated against CLOCK_MONOTONIC at startup instead
+ * of being hard-coded. Reads are charged once per node visit and writes once
+ * per flushed cache line. The *_CYCLES statistics are kept in TSC cycles;
+ * use tsc_to_ns() to report them.
+ */
+inline unsigned long calibrate_tsc_mhz() {
+  struct timespec start, end;
+  long long elapsed_ns;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  unsigned long start_tsc = read_tsc();
+  do {
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed_ns = (end.tv_sec - start.tv_sec) * 1000000000LL +
+                 (end.tv_nsec - start.tv_nsec);
+  } while (elapsed_ns < 10000000); // 10 ms
+  unsigned long end_tsc = read_tsc();
+
+  return (end_tsc - start_tsc) * 1000 / elapsed_ns;
+}
+
+template <typename T>
+unsigned long persist_globals<T>::cpu_freq_mhz = calibrate_tsc_mhz();
+template <typename T> unsigned long persist_globals<T>::write_latency_in_ns = 0;
+template <typename T> unsigned long persist_globals<T>::read_latency_in_ns = 0;
+
+inline unsigned long long tsc_to_ns(unsigned long long cycles) {
+  return cycles * 1000 / persist_globals<>::cpu_freq_mhz;
+}
+
+inline void spin_until(unsigned long etsc) {
+  while (read_tsc() < etsc)
+    cpu_pause();
+}
+
+inline void emulate_read_latency() {
+  typedef persist_globals<> g;
+
+  if (g::read_latency_in_ns)
+    spin_until(read_tsc() + g::read_latency_in_ns * g::cpu_freq_mhz / 1000);
+}
+
+/*
+ * Persistence backend
+ * The cache line write-back instruction is chosen once at startup. CLWB keeps
+ * the line in the cache, CLFLUSHOPT invalidates it but is weakly ordered, and
+ * the legacy CLFLUSH is used only when neither is available. The new
+ * instructions are emitted as raw opcodes so that old assemblers accept them.
+ */
+enum flush_type { FLUSH_CLFLUSH, FLUSH_CLFLUSHOPT, FLUSH_CLWB };
+
+inline int detect_flush_type() {
+  unsigned int eax, ebx, ecx, edx;
+
+  if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+    if (ebx & (1 << 24))
+      return FLUSH_CLWB;
+    if (ebx & (1 << 23))
+      return FLUSH_CLFLUSHOPT;
+  }
+  return FLUSH_CLFLUSH;
+}
+
+template <typename T> int persist_globals<T>::flush_type = detect_flush_type();
+
+// Write back the lines of [data, data + len) without waiting for them.
+// The caller must issue persist_fence() before depending on their durability.
+inline void clflush_nofence(char *data, int len) {
+  typedef persist_globals<> g;
+  volatile char *ptr = (char *)((unsigned long)data & ~(CACHE_LINE_SIZE - 1));
+  unsigned long start_tsc = read_tsc();
+  int lines = 0;
+  for (; ptr < data + len; ptr += CACHE_LINE_SIZE, ++lines) {
+    unsigned long etsc =
+        read_tsc() + g::write_latency_in_ns * g::cpu_freq_mhz / 1000;
+    switch (g::flush_type) {
+    case FLUSH_CLWB:
+      asm volatile(".byte 0x66; xsaveopt %0" : "+m"(*(volatile char *)ptr));
+      break;
+    case FLUSH_CLFLUSHOPT:
+      asm volatile(".byte 0x66; clflush %0" : "+m"(*(volatile char *)ptr));
+      break;
+    default:
+      asm volatile("clflush %0" : "+m"(*(volatile char *)ptr));
+      break;
+    }
+    spin_until(etsc);
+  }
+  stats::add(STAT_FLUSH, lines);
+  stats::add(STAT_FLUSH_BYTES, len);
+  flush_trace::flush(data, len);
+  stats::add(STAT_FLUSH_CYCLES, read_tsc() - start_tsc);
+}
+
+// Wait for every write-back issued so far by this thread
+inline void persist_fence() {
+  flush_trace::fence();
+  if (persist_globals<>::flush_type == FLUSH_CLFLUSH)
+    mfence();
+  else
+    sfence();
+}
+
+inline void clflush(char *data, int len) {
+  // CLWB and CLFLUSHOPT are ordered with older stores to the same line
+  if (persist_globals<>::flush_type == FLUSH_CLFLUSH) {
+    flush_trace::fence();
+    mfence();
+  }
+  clflush_nofence(data, len);
+  persist_fence();
+}
+
+#endif
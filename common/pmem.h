@@ -0,0 +1,209 @@
+/*
+ * PMDK pools
+ * The persistence policy of the PMDK trees, which the tree core in btree.h
+ * takes as its Persist parameter. A page link is a pool_ptr, the distance
+ * of the page from the pool base, and the records of an internal page hold
+ * their children the same way, so a tree reads the same after the pool is
+ * mapped somewhere else. One process opens one pool: the pool, its base and
+ * hybrid mode are kept here, one per process.
+ *
+ * Hybrid mode
+ * btree::constructor(pop, true) keeps only the leaves in the pool. Internal
+ * pages are allocated in DRAM, skip every flush, and are rebuilt from the
+ * leaf sibling chain by btree::open(). A DRAM page is still addressed by
+ * its distance from the pool base, so the tree code follows one kind of
+ * pointer whatever the level.
+ *
+ * pool_persist() and stats_flush() count and trace the flushes of a pool
+ * the way clflush_nofence() does in persist.h.
+ */
+#ifndef FAST_FAIR_PMEM_H
+#define FAST_FAIR_PMEM_H
+
+#include <libpmemobj.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "flush_trace.h"
+#include "reserve.h"
+#include "stats.h"
+
+// pmemobj_persist() of a field outside the pages, traced like a page flush
+inline void pool_persist(PMEMobjpool *pop, const void *addr, size_t len) {
+  flush_trace::flush(addr, len);
+  flush_trace::fence();
+  pmemobj_persist(pop, addr, len);
+}
+
+// count a write-back of [addr, addr + len)
+inline void stats_flush(const void *addr, size_t len) {
+  uint64_t first = (uint64_t)addr / CACHE_LINE_SIZE;
+  uint64_t last = ((uint64_t)addr + len - 1) / CACHE_LINE_SIZE;
+
+  stats::add(STAT_FLUSH, last - first + 1);
+  stats::add(STAT_FLUSH_BYTES, len);
+  flush_trace::flush(addr, len);
+}
+
+// the pool of this process
+template <typename T = void> struct pmem_globals {
+  static bool hybrid_inner; // internal pages of the open tree are in DRAM
+  static PMEMobjpool *pool_pop;
+  static uint64_t pool_uuid_lo;
+  static uint64_t pool_base;
+};
+
+template <typename T> bool pmem_globals<T>::hybrid_inner = false;
+template <typename T> PMEMobjpool *pmem_globals<T>::pool_pop;
+template <typename T> uint64_t pmem_globals<T>::pool_uuid_lo;
+template <typename T> uint64_t pmem_globals<T>::pool_base;
+
+// take pop, which holds obj, as the pool of this process
+inline void set_pool(PMEMobjpool *pop, const void *obj) {
+  typedef pmem_globals<> g;
+  PMEMoid oid = pmemobj_oid(obj);
+
+  g::pool_pop = pop;
+  g::pool_uuid_lo = oid.pool_uuid_lo;
+  g::pool_base = (uint64_t)obj - oid.off;
+}
+
+// the oid of a page, in the pool or not
+inline PMEMoid pool_oid(const void *p) {
+  typedef pmem_globals<> g;
+  PMEMoid oid = {g::pool_uuid_lo, (uint64_t)p - g::pool_base};
+  return oid;
+}
+
+inline bool volatile_level(uint32_t level) {
+  return pmem_globals<>::hybrid_inner && level > 0;
+}
+
+// an 8-byte link to a T of the pool, or to a DRAM page of hybrid mode
+template <typename T> class pool_ptr {
+private:
+  uint64_t off; // from pool_base, 0 for NULL
+
+public:
+  pool_ptr() = default;
+  pool_ptr(T *p) : off(p ? (uint64_t)p - pmem_globals<>::pool_base : 0) {}
+
+  operator T *() const {
+    return off ? (T *)(pmem_globals<>::pool_base + off) : NULL;
+  }
+  T *operator->() const { return (T *)(pmem_globals<>::pool_base + off); }
+};
+
+/*
+ * Persistence policy
+ * Layout gives the type numbers of the pool objects: page_type() of the
+ * pages and tree_type() of the trees a sharded tree allocates.
+ */
+template <typename Layout> struct pmdk_persist {
+  template <typename T> using link = pool_ptr<T>;
+  typedef PMEMobjpool pool_type;
+
+  // a page as the records of its parent hold it, and back
+  static char *word(const void *p) {
+    return p ? (char *)((uint64_t)p - pmem_globals<>::pool_base) : NULL;
+  }
+  template <typename T> static T *at(const char *w) {
+    return w ? (T *)(pmem_globals<>::pool_base + (uint64_t)w) : NULL;
+  }
+
+  static bool volatile_level(uint32_t level) { return ::volatile_level(level); }
+
+  static void persist(uint32_t level, const void *addr, size_t len) {
+    if (!volatile_level(level)) {
+      stats_flush(addr, len);
+      flush_trace::fence();
+      pmemobj_persist(pmem_globals<>::pool_pop, addr, len);
+    }
+  }
+
+  static void persist_flush(uint32_t level, const void *addr, size_t len) {
+    if (!volatile_level(level)) {
+      stats_flush(addr, len);
+      pmemobj_flush(pmem_globals<>::pool_pop, addr, len);
+    }
+  }
+
+  static void persist_drain(uint32_t level) {
+    if (!volatile_level(level)) {
+      flush_trace::fence();
+      pmemobj_drain(pmem_globals<>::pool_pop);
+    }
+  }
+
+  // a field of the tree object
+  static void persist_tree(const void *addr, size_t len) {
+    pool_persist(pmem_globals<>::pool_pop, addr, len);
+  }
+
+  // make page the root; a root in DRAM is found again by btree::open()
+  template <typename T>
+  static void set_root(pool_type *, link<T> &root, T *page, uint32_t level) {
+    root = page;
+    if (!volatile_level(level))
+      pool_persist(pmem_globals<>::pool_pop, &root, sizeof(root));
+  }
+
+  static void emulate_read() {}
+
+  // take pop, which holds the tree obj, as the pool of this process
+  static void attach(pool_type *pop, const void *obj, bool hybrid) {
+    set_pool(pop, obj);
+    pmem_globals<>::hybrid_inner = hybrid;
+  }
+
+  // a page for level: in DRAM if the level is volatile, else from the
+  // reserver's stock of this thread or allocated
+  template <size_t Size> static void *alloc_page(uint32_t level) {
+    void *addr;
+
+    if (volatile_level(level)) {
+      if (posix_memalign(&addr, CACHE_LINE_SIZE, Size)) {
+        perror("posix_memalign fail");
+        exit(1);
+      }
+      return addr;
+    }
+
+    PMEMoid oid =
+        page_reserve::take(pmem_globals<>::pool_pop, Size, Layout::page_type());
+    if ((addr = pmemobj_direct(oid)) == NULL) {
+      fprintf(stderr, "the pool is full\n");
+      exit(1);
+    }
+    return addr;
+  }
+
+  template <size_t Size> static void free_page(void *p, uint32_t level) {
+    if (volatile_level(level)) {
+      free(p);
+    } else {
+      PMEMoid oid = pool_oid(p);
+      pmemobj_free(&oid);
+    }
+  }
+
+  static void *alloc_tree(size_t size) {
+    PMEMoid oid;
+
+    if (pmemobj_alloc(pmem_globals<>::pool_pop, &oid, size,
+                      Layout::tree_type(), NULL, NULL)) {
+      fprintf(stderr, "the pool is full\n");
+      exit(1);
+    }
+    return pmemobj_direct(oid);
+  }
+
+  // reserve the pages of splits ahead, see reserve.h
+  template <size_t Size> static void start_reserver() {
+    page_reserve::start(pmem_globals<>::pool_pop, Size, Layout::page_type());
+  }
+  static void stop_reserver() { page_reserve::stop(); }
+};
+
+#endif
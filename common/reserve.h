@@ -0,0 +1,227 @@
+/*
+ * Page reservations
+ * After start_reserver(), the pages of splits and new roots come from a
+ * per-thread stock of pmemobj_xreserve() reservations instead of POBJ_NEW,
+ * so the allocator has found and claimed the memory beforehand and only
+ * pmemobj_publish() is left on the insert path. A background thread tops a
+ * stock up to RESERVE_BATCH pages once it falls under half of that; a
+ * thread whose stock is empty allocates on the spot as before. The pages
+ * come from an allocation class of their own size with compact headers.
+ *
+ * A reservation lives only in DRAM, so one that was never published when
+ * the process died is free space again once the pool is opened, and there
+ * is nothing to recover. The stocks of threads that exit go to the next
+ * refill. stop_reserver() cancels every reservation left and must run before
+ * the pool is closed, with no tree operation in flight.
+ */
+#ifndef FAST_FAIR_RESERVE_H
+#define FAST_FAIR_RESERVE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <libpmemobj.h>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifndef RESERVE_BATCH
+#define RESERVE_BATCH 64
+#endif
+
+#define RESERVE_CLASS_UNITS 1024 // pages in one block of the class
+#define RESERVE_WAKEUP_MS 1      // refiller's longest sleep between checks
+
+template <typename T = void> class basic_page_reserve {
+  struct reservation {
+    pobj_action act;
+    PMEMoid oid;
+  };
+
+  struct stock {
+    std::mutex mtx; // taken by the owner and by the refiller
+    std::vector<reservation> pages;
+    std::atomic<bool> wanted;
+
+    stock() : wanted(false) {
+      std::lock_guard<std::mutex> guard(mtx_stocks);
+      stocks.push_back(this);
+    }
+
+    ~stock() {
+      std::lock_guard<std::mutex> guard(mtx_stocks);
+      spare.insert(spare.end(), pages.begin(), pages.end());
+      stocks.erase(std::find(stocks.begin(), stocks.end(), this));
+    }
+  };
+
+  static thread_local stock local;
+  static std::mutex mtx_stocks; // guards stocks and spare; held by a refill
+  static std::vector<stock *> stocks;
+  static std::vector<reservation> spare;
+  static std::condition_variable refill_cv;
+
+  static std::atomic<PMEMobjpool *> pool; // the pool the stocks are for
+  static size_t page_size;
+  static uint64_t type_num, flags;
+  static std::thread *refiller;
+  static bool stopping;
+
+  // fill s up to RESERVE_BATCH pages, the spare ones first
+  static void top_up(stock *s) {
+    std::vector<reservation> fresh;
+    size_t have;
+    {
+      std::lock_guard<std::mutex> guard(s->mtx);
+      have = s->pages.size();
+    }
+
+    while (have + fresh.size() < RESERVE_BATCH) {
+      reservation r;
+      if (!spare.empty()) {
+        r = spare.back();
+        spare.pop_back();
+      } else {
+        r.oid = pmemobj_xreserve(pool, &r.act, page_size, type_num, flags);
+        if (OID_IS_NULL(r.oid))
+          break;
+      }
+      fresh.push_back(r);
+    }
+
+    std::lock_guard<std::mutex> guard(s->mtx);
+    s->pages.insert(s->pages.end(), fresh.begin(), fresh.end());
+    s->wanted = false;
+  }
+
+  static bool any_wanted() {
+    for (size_t i = 0; i < stocks.size(); ++i)
+      if (stocks[i]->wanted)
+        return true;
+    return false;
+  }
+
+  static void refill() {
+    std::unique_lock<std::mutex> guard(mtx_stocks);
+
+    while (!stopping) {
+      for (size_t i = 0; i < stocks.size(); ++i)
+        if (stocks[i]->wanted)
+          top_up(stocks[i]);
+      // a wakeup is sent without the lock and may be missed, hence the limit
+      refill_cv.wait_for(guard, std::chrono::milliseconds(RESERVE_WAKEUP_MS),
+                         [] { return stopping || any_wanted(); });
+    }
+  }
+
+public:
+  // Keep stocks of pages of len bytes and type type in pop from now on
+  static void start(PMEMobjpool *pop, size_t len, uint64_t type) {
+    if (refiller)
+      return;
+
+    pobj_alloc_class_desc desc;
+    desc.unit_size = len;
+    desc.alignment = CACHE_LINE_SIZE;
+    desc.units_per_block = RESERVE_CLASS_UNITS;
+    desc.header_type = POBJ_HEADER_COMPACT;
+    if (pmemobj_ctl_set(pop, "heap.alloc_class.new.desc", &desc) == 0)
+      flags = POBJ_CLASS_ID(desc.class_id);
+    else
+      flags = 0; // the default classes
+
+    page_size = len;
+    type_num = type;
+    stopping = false;
+    pool.store(pop, std::memory_order_release);
+    refiller = new std::thread(refill);
+  }
+
+  static void stop() {
+    if (!refiller)
+      return;
+
+    {
+      std::lock_guard<std::mutex> guard(mtx_stocks);
+      stopping = true;
+    }
+    refill_cv.notify_one();
+    refiller->join();
+    delete refiller;
+    refiller = NULL;
+
+    PMEMobjpool *pop = pool.exchange(NULL);
+    std::lock_guard<std::mutex> guard(mtx_stocks);
+    for (size_t i = 0; i < stocks.size(); ++i) {
+      std::lock_guard<std::mutex> stock_guard(stocks[i]->mtx);
+      spare.insert(spare.end(), stocks[i]->pages.begin(),
+                   stocks[i]->pages.end());
+      stocks[i]->pages.clear();
+      stocks[i]->wanted = false;
+    }
+    for (size_t i = 0; i < spare.size(); ++i)
+      pmemobj_cancel(pop, &spare[i].act, 1);
+    spare.clear();
+  }
+
+  // A page of len bytes and type type in pop, published from this thread's
+  // stock if there is one for pop, else allocated; OID_NULL if pop is full
+  static PMEMoid take(PMEMobjpool *pop, size_t len, uint64_t type) {
+    if (pop == pool.load(std::memory_order_acquire) && len == page_size) {
+      stock &s = local;
+      reservation r;
+      bool reserved = false;
+      {
+        std::lock_guard<std::mutex> guard(s.mtx);
+        if (!s.pages.empty()) {
+          r = s.pages.back();
+          s.pages.pop_back();
+          reserved = true;
+        }
+        if (s.pages.size() < RESERVE_BATCH / 2 && !s.wanted.exchange(true))
+          refill_cv.notify_one();
+      }
+      if (reserved) {
+        if (pmemobj_publish(pop, &r.act, 1) == 0)
+          return r.oid;
+        pmemobj_cancel(pop, &r.act, 1);
+      }
+    }
+
+    PMEMoid oid;
+    if (pmemobj_alloc(pop, &oid, len, type, NULL, NULL))
+      return OID_NULL;
+    return oid;
+  }
+};
+
+typedef basic_page_reserve<> page_reserve;
+
+template <typename T>
+thread_local typename basic_page_reserve<T>::stock
+    basic_page_reserve<T>::local;
+template <typename T>
+std::mutex basic_page_reserve<T>::mtx_stocks;
+template <typename T>
+std::vector<typename basic_page_reserve<T>::stock *>
+    basic_page_reserve<T>::stocks;
+template <typename T>
+std::vector<typename basic_page_reserve<T>::reservation>
+    basic_page_reserve<T>::spare;
+template <typename T>
+std::condition_variable basic_page_reserve<T>::refill_cv;
+template <typename T>
+std::atomic<PMEMobjpool *> basic_page_reserve<T>::pool(NULL);
+template <typename T>
+size_t basic_page_reserve<T>::page_size = 0;
+template <typename T>
+uint64_t basic_page_reserve<T>::type_num = 0;
+template <typename T>
+uint64_t basic_page_reserve<T>::flags = 0;
+template <typename T>
+std::thread *basic_page_reserve<T>::refiller = NULL;
+template <typename T>
+bool basic_page_reserve<T>::stopping = false;
+
+#endif
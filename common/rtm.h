@@ -0,0 +1,52 @@
+/*
+ * Lock elision
+ * Built with -DRTM_ELISION (make RTM=1), a FAST insert into a page runs as
+ * an RTM transaction that only reads the page's version lock instead of
+ * taking it, so a writer that does take the lock aborts it. The insert is
+ * elided only when every slot it shifts is in one cache line: the lines of
+ * a transaction reach memory in no particular order once it commits, and
+ * FAST needs a line written back before the shift enters the next one.
+ * Its flushes are issued after the commit; a writer that changes the line
+ * in between writes it back itself, as every FAST shift does. Splits,
+ * sibling hops, multi-line shifts and transactions that abort RTM_RETRIES
+ * times take the lock.
+ *
+ * rtm_globals<>::lock_elision starts out true when CPUID reports RTM; clear
+ * it to measure the same build with locks.
+ */
+#ifndef FAST_FAIR_RTM_H
+#define FAST_FAIR_RTM_H
+
+#ifdef RTM_ELISION
+#include <cpuid.h>
+#include <immintrin.h>
+
+#ifndef RTM_RETRIES
+#define RTM_RETRIES 3
+#endif
+
+// explicit abort codes
+#define RTM_ABORT_LOCKED 0x01 // a writer holds the lock
+#define RTM_ABORT_PATH 0x02   // the write needs the locked path
+
+inline bool detect_rtm() {
+  unsigned int eax, ebx, ecx, edx;
+
+  return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & (1 << 11));
+}
+
+template <typename T = void> struct rtm_globals {
+  static bool lock_elision;
+};
+
+template <typename T> bool rtm_globals<T>::lock_elision = detect_rtm();
+
+// whether to try the transaction again after an abort with status
+inline bool rtm_retry(unsigned int status) {
+  if (status & _XABORT_EXPLICIT)
+    return _XABORT_CODE(status) == RTM_ABORT_LOCKED;
+  return status & (_XABORT_RETRY | _XABORT_CONFLICT);
+}
+#endif
+
+#endif
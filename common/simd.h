@@ -0,0 +1,105 @@
+/*
+ * SIMD in-node search
+ * The kernels scan the (key, ptr) slots of a node and return the position of
+ * the first slot that either matches the search key or holds the NULL
+ * terminator, encoded as 2 * slot for a key match and 2 * slot + 1 for the
+ * terminator. A match means key == slot key for leaves and key < slot key
+ * for internal nodes. -1 means that no kernel applies and the caller must use
+ * the scalar scan. The result is only a candidate: page::simd_search() still
+ * applies the FAST duplicate-pointer rule and the switch_counter check to it.
+ */
+#ifndef FAST_FAIR_SIMD_H
+#define FAST_FAIR_SIMD_H
+
+#include <cpuid.h>
+#include <immintrin.h>
+#include <stdint.h>
+
+enum simd_type { SIMD_NONE, SIMD_AVX2, SIMD_AVX512 };
+
+inline int detect_simd_type() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return SIMD_AVX512;
+  if (__builtin_cpu_supports("avx2"))
+    return SIMD_AVX2;
+  return SIMD_NONE;
+}
+
+// Off unless built with -DSIMD_SEARCH: with the default 512-byte pages the
+// early-exit scalar scan is as fast as the vector kernels on current cores.
+template <typename T = void> struct simd_globals {
+  static int simd_type; // the kernel simd_scan() dispatches to
+};
+
+#ifdef SIMD_SEARCH
+template <typename T> int simd_globals<T>::simd_type = detect_simd_type();
+#else
+template <typename T> int simd_globals<T>::simd_type = SIMD_NONE;
+#endif
+
+__attribute__((target("avx512f"))) inline int
+simd_scan_avx512(const char *slots, int n, int64_t key, bool less) {
+  const __m512i k = _mm512_set1_epi64(key);
+  const __m512i zero = _mm512_setzero_si512();
+
+  for (int i = 0; i < n; i += 4) {
+    int lanes = (n - i >= 4) ? 8 : 2 * (n - i);
+    __mmask8 valid = (__mmask8)((1 << lanes) - 1);
+    __m512i v = _mm512_maskz_loadu_epi64(valid, slots + i * 16);
+    unsigned hit = (less ? _mm512_cmpgt_epi64_mask(v, k)
+                         : _mm512_cmpeq_epi64_mask(v, k)) &
+                   valid & 0x55;
+    unsigned null = _mm512_cmpeq_epi64_mask(v, zero) & valid & 0xAA;
+    unsigned m = (hit & ~(null >> 1)) | null;
+    if (m)
+      return 2 * i + __builtin_ctz(m);
+  }
+  return -1;
+}
+
+__attribute__((target("avx2"))) inline int
+simd_scan_avx2(const char *slots, int n, int64_t key, bool less) {
+  const __m256i k = _mm256_set1_epi64x(key);
+  const __m256i zero = _mm256_setzero_si256();
+  int i;
+
+  for (i = 0; i + 2 <= n; i += 2) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(slots + i * 16));
+    __m256i c = less ? _mm256_cmpgt_epi64(v, k) : _mm256_cmpeq_epi64(v, k);
+    unsigned hit = _mm256_movemask_pd(_mm256_castsi256_pd(c)) & 0x5;
+    unsigned null = _mm256_movemask_pd(_mm256_castsi256_pd(
+                        _mm256_cmpeq_epi64(v, zero))) &
+                    0xA;
+    unsigned m = (hit & ~(null >> 1)) | null;
+    if (m)
+      return 2 * i + __builtin_ctz(m);
+  }
+
+  if (i < n) { // odd number of slots
+    const int64_t *slot = (const int64_t *)(slots + i * 16);
+    if (slot[1] == 0)
+      return 2 * i + 1;
+    if (less ? key < slot[0] : key == slot[0])
+      return 2 * i;
+  }
+  return -1;
+}
+
+template <typename Key>
+inline int simd_scan(const char *slots, int n, Key key, bool less) {
+  return -1;
+}
+
+inline int simd_scan(const char *slots, int n, int64_t key, bool less) {
+  switch (simd_globals<>::simd_type) {
+  case SIMD_AVX512:
+    return simd_scan_avx512(slots, n, key, less);
+  case SIMD_AVX2:
+    return simd_scan_avx2(slots, n, key, less);
+  default:
+    return -1;
+  }
+}
+
+#endif
@@ -0,0 +1,143 @@
+/*
+ * Page allocator
+ * Pages are carved out of 2MB chunks, mapped with huge pages when the system
+ * has them reserved and aligned for transparent huge pages otherwise. Each
+ * thread carves from its own chunk and recycles from its own free list, so
+ * splits on different threads never meet in the allocator; a thread that
+ * exits hands its free blocks to a shared list that other threads refill
+ * from. With slab_globals<>::slab_numa_local set, a new chunk is bound to
+ * the NUMA node of the thread that maps it. Chunks are never returned to the
+ * system.
+ */
+#ifndef FAST_FAIR_SLAB_H
+#define FAST_FAIR_SLAB_H
+
+#include <mutex>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include "numa.h"
+
+#define SLAB_CHUNK_SIZE (2UL << 20)
+
+template <typename T = void> struct slab_globals {
+  static bool slab_numa_local;
+};
+
+template <typename T> bool slab_globals<T>::slab_numa_local = false;
+
+inline char *slab_map_chunk() {
+  void *p = mmap(NULL, SLAB_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+  if (p == MAP_FAILED) {
+    // no reserved huge pages: map twice the size and keep an aligned chunk
+    char *raw = (char *)mmap(NULL, 2 * SLAB_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+      perror("slab chunk mmap fail");
+      exit(1);
+    }
+
+    char *aligned = (char *)(((uint64_t)raw + SLAB_CHUNK_SIZE - 1) &
+                             ~(SLAB_CHUNK_SIZE - 1));
+    if (aligned > raw)
+      munmap(raw, aligned - raw);
+    munmap(aligned + SLAB_CHUNK_SIZE, raw + SLAB_CHUNK_SIZE - aligned);
+    madvise(aligned, SLAB_CHUNK_SIZE, MADV_HUGEPAGE);
+    p = aligned;
+  }
+
+  if (slab_globals<>::slab_numa_local)
+    numa_bind(p, SLAB_CHUNK_SIZE, numa_current_node());
+
+  return (char *)p;
+}
+
+template <size_t BlockSize> class slab_allocator {
+  static_assert(BlockSize % CACHE_LINE_SIZE == 0,
+                "slab blocks must be cache line aligned");
+
+  struct free_block {
+    free_block *next;
+  };
+
+  struct thread_cache {
+    char *cur, *end; // uncarved part of the current chunk
+    free_block *free_list;
+
+    thread_cache() : cur(NULL), end(NULL), free_list(NULL) {}
+
+    ~thread_cache() {
+      for (; cur + BlockSize <= end; cur += BlockSize)
+        put(&free_list, cur);
+      if (free_list == NULL)
+        return;
+
+      free_block *tail = free_list;
+      while (tail->next)
+        tail = tail->next;
+
+      std::lock_guard<std::mutex> guard(shared_mtx);
+      tail->next = shared_list;
+      shared_list = free_list;
+    }
+  };
+
+  static thread_local thread_cache cache;
+  static std::mutex shared_mtx;
+  static free_block *shared_list;
+
+  static void put(free_block **list, void *p) {
+    free_block *b = (free_block *)p;
+    b->next = *list;
+    *list = b;
+  }
+
+  static void *take(free_block **list) {
+    free_block *b = *list;
+    *list = b->next;
+    return b;
+  }
+
+public:
+  static void *alloc() {
+    thread_cache &c = cache;
+
+    if (c.free_list)
+      return take(&c.free_list);
+
+    if (c.cur + BlockSize > c.end) {
+      {
+        std::lock_guard<std::mutex> guard(shared_mtx);
+        c.free_list = shared_list;
+        shared_list = NULL;
+      }
+      if (c.free_list)
+        return take(&c.free_list);
+
+      c.cur = slab_map_chunk();
+      c.end = c.cur + SLAB_CHUNK_SIZE;
+    }
+
+    void *ret = c.cur;
+    c.cur += BlockSize;
+    return ret;
+  }
+
+  // The block goes to the calling thread's free list, whichever thread
+  // allocated it
+  static void free(void *p) { put(&cache.free_list, p); }
+};
+
+template <size_t BlockSize>
+thread_local typename slab_allocator<BlockSize>::thread_cache
+    slab_allocator<BlockSize>::cache;
+template <size_t BlockSize> std::mutex slab_allocator<BlockSize>::shared_mtx;
+template <size_t BlockSize>
+typename slab_allocator<BlockSize>::free_block
+    *slab_allocator<BlockSize>::shared_list = NULL;
+
+#endif
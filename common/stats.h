@@ -0,0 +1,125 @@
+/*
+ * Hot-path statistics
+ * Each thread counts into its own cache line aligned block, so counting never
+ * writes a line that another thread reads on the hot path. A block joins a
+ * global list on its thread's first count and is folded into a retired total
+ * when the thread exits. stats::snapshot() sums the total and the live blocks
+ * and may run while other threads count; to measure an interval, subtract two
+ * snapshots instead of resetting counters under running threads. On a PMDK
+ * pool flushes are counted where a page hands its own lines to libpmemobj,
+ * which leaves out bulk loading and the btree header, and the *_CYCLES
+ * counters stay zero. The RTM_* counters move only in the concurrent
+ * trees built with RTM=1.
+ */
+#ifndef FAST_FAIR_STATS_H
+#define FAST_FAIR_STATS_H
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string.h>
+#include <vector>
+
+enum stat_counter {
+  STAT_FLUSH,         // cache lines written back
+  STAT_FLUSH_BYTES,   // bytes asked to be written back
+  STAT_RETRY,         // node reads repeated because a writer got in
+  STAT_SIBLING_HOP,   // sibling pointers followed by a search or store
+  STAT_FAST,          // keys put in a node by FAST or in a free slot
+  STAT_FAIR,          // nodes split by FAIR
+  STAT_STORE_RESTART, // inserts restarted because store hit a deleted node
+  STAT_HINT_HIT,      // inserts and searches served by the thread's leaf hint
+  STAT_SEARCH_CYCLES, // TSC cycles btree_insert spent descending
+  STAT_UPDATE_CYCLES, // TSC cycles btree_insert spent in store, less flushes
+  STAT_FLUSH_CYCLES,  // TSC cycles spent in clflush_nofence()
+  STAT_RTM_COMMIT,    // FAST inserts committed under an elided lock
+  STAT_RTM_ABORT,     // elided inserts' transactions that aborted
+  STAT_RTM_FALLBACK,  // elided inserts that took the lock after all
+  STAT_NUM
+};
+
+struct btree_stats {
+  unsigned long long count[STAT_NUM];
+
+  btree_stats() { memset(count, 0, sizeof(count)); }
+
+  unsigned long long operator[](int c) const { return count[c]; }
+
+  // counts between an earlier snapshot and this one
+  btree_stats operator-(const btree_stats &earlier) const {
+    btree_stats d;
+    for (int i = 0; i < STAT_NUM; ++i)
+      d.count[i] = count[i] - earlier.count[i];
+    return d;
+  }
+};
+
+template <typename T = void> class basic_stats {
+  struct alignas(CACHE_LINE_SIZE) block {
+    std::atomic<unsigned long long> count[STAT_NUM];
+
+    block() {
+      for (int i = 0; i < STAT_NUM; ++i)
+        count[i].store(0, std::memory_order_relaxed);
+      std::lock_guard<std::mutex> guard(mtx);
+      blocks.push_back(this);
+    }
+
+    ~block() {
+      std::lock_guard<std::mutex> guard(mtx);
+      for (int i = 0; i < STAT_NUM; ++i)
+        retired.count[i] += count[i].load(std::memory_order_relaxed);
+      blocks.erase(std::find(blocks.begin(), blocks.end(), this));
+    }
+  };
+
+  static thread_local block local;
+  static std::mutex mtx;
+  static std::vector<block *> blocks;
+  static btree_stats retired;
+
+public:
+  // Only the owning thread writes its block, so a plain load and store
+  // suffice and no locked instruction is issued
+  static inline void add(int c, unsigned long long n = 1) {
+    std::atomic<unsigned long long> &v = local.count[c];
+    v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  // the calling thread's own count
+  static inline unsigned long long get(int c) {
+    return local.count[c].load(std::memory_order_relaxed);
+  }
+
+  static btree_stats snapshot() {
+    std::lock_guard<std::mutex> guard(mtx);
+    btree_stats s = retired;
+    for (size_t b = 0; b < blocks.size(); ++b)
+      for (int i = 0; i < STAT_NUM; ++i)
+        s.count[i] += blocks[b]->count[i].load(std::memory_order_relaxed);
+    return s;
+  }
+
+  static const char *name(int c) {
+    static const char *names[STAT_NUM] = {
+        "flush",         "flush_bytes",   "retry",
+        "sibling_hop",   "fast",          "fair",
+        "store_restart", "hint_hit",      "search_cycles",
+        "update_cycles", "flush_cycles",  "rtm_commit",
+        "rtm_abort",     "rtm_fallback"};
+    return names[c];
+  }
+};
+
+typedef basic_stats<> stats;
+
+template <typename T>
+thread_local typename basic_stats<T>::block basic_stats<T>::local;
+template <typename T>
+std::mutex basic_stats<T>::mtx;
+template <typename T>
+std::vector<typename basic_stats<T>::block *> basic_stats<T>::blocks;
+template <typename T>
+btree_stats basic_stats<T>::retired;
+
+#endif
@@ -0,0 +1,50 @@
+/*
+ * CPU and threading helpers
+ * Shared by all four trees.
+ *
+ * The headers in common/ are included by every translation unit of a
+ * program, so they define no plain globals: what is process-wide lives in
+ * static members of a class template, such as persist_globals<> or the
+ * basic_stats<> behind stats, which each unit may define and the linker
+ * folds into one object. Free functions are inline for the same reason.
+ */
+#ifndef FAST_FAIR_UTIL_H
+#define FAST_FAIR_UTIL_H
+
+#include <thread>
+#include <vector>
+
+inline void cpu_pause() { __asm__ volatile("pause" ::: "memory"); }
+// keep the compiler from merging or reordering a lock-free reader's loads
+// of one slot; x86 keeps them in order itself
+inline void compiler_barrier() { __asm__ volatile("" ::: "memory"); }
+inline unsigned long read_tsc(void) {
+  unsigned long var;
+  unsigned int hi, lo;
+
+  asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+  var = ((unsigned long long int)hi << 32) | lo;
+
+  return var;
+}
+
+inline void mfence() { asm volatile("mfence" ::: "memory"); }
+inline void sfence() { asm volatile("sfence" ::: "memory"); }
+
+// Run f(begin, end) over [0, n) split evenly across num_threads threads
+template <typename F>
+void parallel_for(long n, int num_threads, const F &f) {
+  if (num_threads <= 1 || n < num_threads) {
+    f(0L, n);
+    return;
+  }
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; ++t)
+    threads.push_back(
+        std::thread(f, n * t / num_threads, n * (t + 1) / num_threads));
+  for (auto &t : threads)
+    t.join();
+}
+
+#endif
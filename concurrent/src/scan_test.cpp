@@ -0,0 +1,63 @@
+// Scans of a tree that took some keys twice must return each key once, in
+// ascending order, in both leaf formats. `make check` runs it.
+#include "btree.h"
+
+static int failures = 0;
+
+static void expect(bool ok, const char *what, bool unsorted) {
+  if (!ok) {
+    printf("FAIL %s (%s leaves)\n", what, unsorted ? "unsorted" : "sorted");
+    ++failures;
+  }
+}
+
+static void check_duplicates(bool unsorted) {
+  const long num = 20000;
+
+  btree_globals<>::unsorted_leaves = unsorted;
+  btree<> *bt = new btree<>();
+  for (long i = 1; i <= num; ++i) {
+    bt->btree_insert(i, (char *)i);
+    if (i % 3 == 0) // again, while the first copy is still in the leaf
+      bt->btree_insert(i, (char *)i);
+  }
+
+  btree_cursor<> cursor(bt, 0, num + 1);
+  entry_key_t keys[64];
+  char *values[64];
+  long seen = 0, last = 0;
+  bool ascending = true;
+  int n;
+  while ((n = cursor.next(keys, values, 64)) > 0) {
+    for (int i = 0; i < n; ++i) {
+      ascending = ascending && keys[i] > last;
+      last = keys[i];
+    }
+    seen += n;
+  }
+  expect(ascending, "cursor keys ascend", unsorted);
+  expect(seen == num, "cursor returns each key once", unsorted);
+
+  std::vector<unsigned long> buf(2 * num);
+  bt->btree_search_range(0, num + 1, buf.data());
+  bool all = true;
+  for (long i = 0; i < num; ++i)
+    all = all && buf[i] == (unsigned long)(i + 1);
+  expect(all, "btree_search_range returns each key once", unsorted);
+
+  scan_aggregate<entry_key_t> agg = bt->btree_aggregate(0, num + 1, 2);
+  expect(agg.count == num, "btree_aggregate counts each key once", unsorted);
+
+  delete bt;
+}
+
+int main() {
+  check_duplicates(false);
+  check_duplicates(true);
+  btree_globals<>::unsorted_leaves = false;
+
+  if (failures)
+    return 1;
+  printf("scan_test: ok\n");
+  return 0;
+}
@@ -1,4 +1,5 @@
 #include "btree.h"
+#include "../../bench/trace.h"
 
 void clear_cache() {
   // Remove cache
@@ -11,65 +12,107 @@ void clear_cache() {
   delete[] garbage;
 }
 
+// print the event counts of d, leaving out the cycle counters and the lock
+// elision ones unless built with RTM=1
+void print_stats(const btree_stats &d) {
+  cout << "Stats:";
+  for (int i = 0; i < STAT_SEARCH_CYCLES; ++i)
+    cout << " " << stats::name(i) << " " << d[i];
+#ifdef RTM_ELISION
+  for (int i = STAT_RTM_COMMIT; i < STAT_NUM; ++i)
+    cout << " " << stats::name(i) << " " << d[i];
+#endif
+  cout << endl;
+}
+
 // MAIN
 int main(int argc, char **argv) {
   // Parsing arguments
   int numData = 0;
   int n_threads = 1;
-  char *input_path = (char *)std::string("../sample_input.txt").data();
+  const char *input_path = "../sample_input.txt";
+  const char *pool_path = NULL;
+  int replica_levels = 0;
+  bool bulk_load = false;
 
   int c;
-  while ((c = getopt(argc, argv, "n:w:t:i:")) != -1) {
+  while ((c = getopt(argc, argv, "n:w:r:t:i:p:uN:b")) != -1) {
     switch (c) {
     case 'n':
       numData = atoi(optarg);
       break;
     case 'w':
-      write_latency_in_ns = atol(optarg);
+      persist_globals<>::write_latency_in_ns = atol(optarg);
+      break;
+    case 'r':
+      persist_globals<>::read_latency_in_ns = atol(optarg);
       break;
     case 't':
       n_threads = atoi(optarg);
       break;
     case 'i':
       input_path = optarg;
+      break;
+    case 'p':
+      pool_path = optarg; // keep the tree in a DAX pool
+      break;
+    case 'u':
+      btree_globals<>::unsorted_leaves = true; // leaves take keys in free slots
+      break;
+    case 'N':
+      replica_levels = atoi(optarg); // replicate the top levels per node
+      break;
+    case 'b':
+      bulk_load = true; // build the warm-up half bottom-up
+      break;
     default:
       break;
     }
   }
 
-  btree *bt;
-  bt = new btree();
+  btree<> *bt;
+  dax_pool *pool = NULL;
+  if (pool_path) {
+    if (access(pool_path, F_OK) != 0)
+      pool = dax_pool::create(pool_path, 8000000000);
+    else
+      pool = dax_pool::open(pool_path);
+    if (!pool)
+      exit(-1);
+    bt = new btree<>(pool);
+  } else {
+    bt = new btree<>();
+  }
+  if (replica_levels > 0)
+    bt->numa_replicate(replica_levels);
 
   struct timespec start, end, tmp;
 
-  // Reading data
-  entry_key_t *keys = new entry_key_t[numData];
-
-  ifstream ifs;
-  ifs.open(input_path);
-
-  if (!ifs) {
+  // Reading data: a binary trace is mapped, a text file is parsed
+  trace input;
+  long num_keys = numData;
+  entry_key_t *keys = load_keys(input_path, &num_keys, &input);
+  if (!keys) {
     cout << "input loading error!" << endl;
+    exit(-1);
   }
-
-  for (int i = 0; i < numData; ++i) {
-    ifs >> keys[i];
-  }
-  ifs.close();
-
-  // Initializing stats
-  clflush_cnt = 0;
-  search_time_in_insert = 0;
-  clflush_time_in_insert = 0;
-  gettime_cnt = 0;
+  numData = num_keys;
 
   clock_gettime(CLOCK_MONOTONIC, &start);
 
   long half_num_data = numData / 2;
 
   // Warm-up! Insert half of input size
-  for (int i = 0; i < half_num_data; ++i) {
-    bt->btree_insert(keys[i], (char *)keys[i]);
+  if (bulk_load) {
+    vector<entry_key_t> sorted(keys, keys + half_num_data);
+    sort(sorted.begin(), sorted.end());
+    sorted.erase(unique(sorted.begin(), sorted.end()), sorted.end());
+    bt->btree_bulk_load(sorted.data(), (char **)sorted.data(), sorted.size(),
+                        1.0, n_threads);
+  } else {
+    for (int i = 0; i < half_num_data; ++i) {
+      bt->btree_insert(keys[i], (char *)keys[i]);
+    }
   }
   cout << "Warm-up!" << endl;
 
@@ -80,7 +123,8 @@ int main(int argc, char **argv) {
   clear_cache();
 
   // Multithreading
-  vector<future<void>> futures(n_threads);
+  vector<future<void>> futures;
+  futures.reserve(n_threads);
 
   long data_per_thread = half_num_data / n_threads;
 
@@ -101,8 +145,7 @@ int main(int argc, char **argv) {
     futures.push_back(move(f));
   }
   for (auto &&f : futures)
-    if (f.valid())
-      f.get();
+    f.get();
 
   clock_gettime(CLOCK_MONOTONIC, &end);
   elapsedTime =
@@ -114,6 +157,8 @@ int main(int argc, char **argv) {
   futures.clear();
 
   // Insert
+  btree_stats before = stats::snapshot();
+
   clock_gettime(CLOCK_MONOTONIC, &start);
 
   for (int tid = 0; tid < n_threads; tid++) {
@@ -129,15 +174,41 @@ int main(int argc, char **argv) {
     futures.push_back(move(f));
   }
   for (auto &&f : futures)
-    if (f.valid())
-      f.get();
+    f.get();
 
   clock_gettime(CLOCK_MONOTONIC, &end);
   elapsedTime =
       (end.tv_sec - start.tv_sec) * 1000000000 + (end.tv_nsec - start.tv_nsec);
   cout << "Concurrent inserting with " << n_threads
        << " threads (usec) : " << elapsedTime / 1000 << endl;
+
+  btree_stats d = stats::snapshot() - before;
+  long num_inserted = numData - half_num_data;
+  cout << "Insert breakdown (ns/op) search: "
+       << (double)tsc_to_ns(d[STAT_SEARCH_CYCLES]) / num_inserted
+       << ", update: "
+       << (double)tsc_to_ns(d[STAT_UPDATE_CYCLES]) / num_inserted
+       << ", clflush: "
+       << (double)tsc_to_ns(d[STAT_FLUSH_CYCLES]) / num_inserted << endl;
+  print_stats(d);
+
+  clear_cache();
+
+  // Count the whole tree
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  scan_aggregate<> total = bt->btree_aggregate(
+      std::numeric_limits<entry_key_t>::min(),
+      std::numeric_limits<entry_key_t>::max(), n_threads);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  elapsedTime =
+      (end.tv_sec - start.tv_sec) * 1000000000 + (end.tv_nsec - start.tv_nsec);
+  cout << "Parallel scan of " << total.count << " keys with " << n_threads
+       << " threads (usec) : " << elapsedTime / 1000 << endl;
 #else
+  btree_stats before = stats::snapshot();
+
   clock_gettime(CLOCK_MONOTONIC, &start);
 
   for (int tid = 0; tid < n_threads; tid++) {
@@ -186,18 +257,22 @@ int main(int argc, char **argv) {
   }
 
   for (auto &&f : futures)
-    if (f.valid())
-      f.get();
+    f.get();
 
   clock_gettime(CLOCK_MONOTONIC, &end);
   elapsedTime =
       (end.tv_sec - start.tv_sec) * 1000000000 + (end.tv_nsec - start.tv_nsec);
   cout << "Concurrent inserting and searching with " << n_threads
        << " threads (usec) : " << elapsedTime / 1000 << endl;
+  print_stats(stats::snapshot() - before);
 #endif
 
+  flush_trace::report(stdout); // empty unless built with TRACE=1
+
   delete bt;
-  delete[] keys;
+  if (pool)
+    pool->close();
+  free_keys(keys, &input);
 
   return 0;
 }
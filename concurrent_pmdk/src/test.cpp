@@ -1,4 +1,5 @@
 #include "btree.h"
+#include "../../bench/trace.h"
 
 /*
  *  *file_exists -- checks if file exists
@@ -16,16 +17,30 @@ void clear_cache() {
   delete[] garbage;
 }
 
+// print the event counts of d, leaving out the cycle counters, which stay
+// zero on a pool, and the lock elision ones unless built with RTM=1
+void print_stats(const btree_stats &d) {
+  cout << "Stats:";
+  for (int i = 0; i < STAT_SEARCH_CYCLES; ++i)
+    cout << " " << stats::name(i) << " " << d[i];
+#ifdef RTM_ELISION
+  for (int i = STAT_RTM_COMMIT; i < STAT_NUM; ++i)
+    cout << " " << stats::name(i) << " " << d[i];
+#endif
+  cout << endl;
+}
+
 // MAIN
 int main(int argc, char **argv) {
   // Parsing arguments
   int numData = 0;
   int n_threads = 1;
-  char *input_path = (char *)std::string("../sample_input.txt").data();
+  const char *input_path = "../sample_input.txt";
   char *persistent_path;
+  bool hybrid = false, reserve = false;
 
   int c;
-  while ((c = getopt(argc, argv, "n:w:t:i:p:")) != -1) {
+  while ((c = getopt(argc, argv, "n:w:t:i:p:dR")) != -1) {
     switch (c) {
     case 'n':
       numData = atoi(optarg);
@@ -35,8 +50,16 @@ int main(int argc, char **argv) {
       break;
     case 'i':
       input_path = optarg;
+      break;
     case 'p':
       persistent_path = optarg;
+      break;
+    case 'd':
+      hybrid = true; // internal nodes in DRAM
+      break;
+    case 'R':
+      reserve = true; // split pages reserved on a background thread
+      break;
     default:
       break;
     }
@@ -50,28 +73,26 @@ int main(int argc, char **argv) {
     pop = pmemobj_create(persistent_path, "btree", 8000000000,
                          0666); // make 1GB memory pool
     bt = POBJ_ROOT(pop, btree);
-    D_RW(bt)->constructor(pop);
+    D_RW(bt)->constructor(pop, hybrid);
   } else {
     pop = pmemobj_open(persistent_path, "btree");
     bt = POBJ_ROOT(pop, btree);
+    D_RW(bt)->open(pop, n_threads);
   }
+  if (reserve)
+    D_RW(bt)->start_reserver();
 
   struct timespec start, end, tmp;
 
-  // Reading data
-  entry_key_t *keys = new entry_key_t[numData];
-
-  ifstream ifs;
-  ifs.open(input_path);
-
-  if (!ifs) {
+  // Reading data: a binary trace is mapped, a text file is parsed
+  trace input;
+  long num_keys = numData;
+  entry_key_t *keys = load_keys(input_path, &num_keys, &input);
+  if (!keys) {
     cout << "input loading error!" << endl;
+    exit(-1);
   }
-
-  for (int i = 0; i < numData; ++i) {
-    ifs >> keys[i];
-  }
-  ifs.close();
+  numData = num_keys;
 
   clock_gettime(CLOCK_MONOTONIC, &start);
 
@@ -89,7 +110,8 @@ int main(int argc, char **argv) {
   clear_cache();
 
   // Multithreading
-  vector<future<void>> futures(n_threads);
+  vector<future<void>> futures;
+  futures.reserve(n_threads);
 
   long data_per_thread = half_num_data / n_threads;
 
@@ -110,8 +132,7 @@ int main(int argc, char **argv) {
     futures.push_back(move(f));
   }
   for (auto &&f : futures)
-    if (f.valid())
-      f.get();
+    f.get();
 
   clock_gettime(CLOCK_MONOTONIC, &end);
   elapsedTime =
@@ -123,6 +144,7 @@ int main(int argc, char **argv) {
   futures.clear();
 
   // Insert
+  btree_stats before = stats::snapshot();
   clock_gettime(CLOCK_MONOTONIC, &start);
 
   for (int tid = 0; tid < n_threads; tid++) {
@@ -138,15 +160,16 @@ int main(int argc, char **argv) {
     futures.push_back(move(f));
   }
   for (auto &&f : futures)
-    if (f.valid())
-      f.get();
+    f.get();
 
   clock_gettime(CLOCK_MONOTONIC, &end);
   elapsedTime =
       (end.tv_sec - start.tv_sec) * 1000000000 + (end.tv_nsec - start.tv_nsec);
   cout << "Concurrent inserting with " << n_threads
        << " threads (usec) : " << elapsedTime / 1000 << endl;
+  print_stats(stats::snapshot() - before);
 #else
+  btree_stats before = stats::snapshot();
   clock_gettime(CLOCK_MONOTONIC, &start);
 
   for (int tid = 0; tid < n_threads; tid++) {
@@ -201,18 +224,21 @@ int main(int argc, char **argv) {
   }
 
   for (auto &&f : futures)
-    if (f.valid())
-      f.get();
+    f.get();
 
   clock_gettime(CLOCK_MONOTONIC, &end);
   elapsedTime =
       (end.tv_sec - start.tv_sec) * 1000000000 + (end.tv_nsec - start.tv_nsec);
   cout << "Concurrent inserting and searching with " << n_threads
        << " threads (usec) : " << elapsedTime / 1000 << endl;
+  print_stats(stats::snapshot() - before);
 #endif
 
-  delete[] keys;
+  flush_trace::report(stdout); // empty unless built with TRACE=1
+
+  free_keys(keys, &input);
 
+  D_RW(bt)->stop_reserver();
   pmemobj_close(pop);
   return 0;
 }
@@ -1,4 +1,5 @@
 #include "btree.h"
+#include "../../bench/trace.h"
 
 void clear_cache() {
   // Remove cache
@@ -11,22 +12,33 @@ void clear_cache() {
   delete[] garbage;
 }
 
+// print the event counts of d, leaving out the cycle counters
+void print_stats(const char *phase, const btree_stats &d) {
+  printf("%s stats:", phase);
+  for (int i = 0; i < STAT_SEARCH_CYCLES; ++i)
+    printf(" %s %llu", stats::name(i), d[i]);
+  printf("\n");
+}
+
 // MAIN
 int main(int argc, char **argv) {
   // Parsing arguments
   int num_data = 0;
   int n_threads = 1;
   float selection_ratio = 0.0f;
-  char *input_path = (char *)std::string("../sample_input.txt").data();
+  const char *input_path = "../sample_input.txt";
 
   int c;
-  while ((c = getopt(argc, argv, "n:w:t:s:i:")) != -1) {
+  while ((c = getopt(argc, argv, "n:w:r:t:s:i:")) != -1) {
     switch (c) {
     case 'n':
       num_data = atoi(optarg);
       break;
     case 'w':
-      write_latency_in_ns = atol(optarg);
+      persist_globals<>::write_latency_in_ns = atol(optarg);
+      break;
+    case 'r':
+      persist_globals<>::read_latency_in_ns = atol(optarg);
       break;
     case 't':
       n_threads = atoi(optarg);
@@ -40,29 +52,23 @@ int main(int argc, char **argv) {
     }
   }
 
-  btree *bt;
-  bt = new btree();
+  btree<> *bt;
+  bt = new btree<>();
 
   struct timespec start, end;
 
-  // Reading data
-  entry_key_t *keys = new entry_key_t[num_data];
-
-  ifstream ifs;
-  ifs.open(input_path);
-  if (!ifs) {
+  // Reading data: a binary trace is mapped, a text file is parsed
+  trace input;
+  long num_keys = num_data;
+  entry_key_t *keys = load_keys(input_path, &num_keys, &input);
+  if (!keys) {
     cout << "input loading error!" << endl;
-
-    delete[] keys;
     exit(-1);
   }
-
-  for (int i = 0; i < num_data; ++i)
-    ifs >> keys[i];
-
-  ifs.close();
+  num_data = num_keys;
 
   {
+    btree_stats before = stats::snapshot();
     clock_gettime(CLOCK_MONOTONIC, &start);
 
     for (int i = 0; i < num_data; ++i) {
@@ -74,9 +80,15 @@ int main(int argc, char **argv) {
     long long elapsed_time = (end.tv_sec - start.tv_sec) * 1000000000 +
                              (end.tv_nsec - start.tv_nsec);
     elapsed_time /= 1000;
+    btree_stats d = stats::snapshot() - before;
 
     printf("INSERT elapsed_time: %ld, Avg: %f\n", elapsed_time,
            (double)elapsed_time / num_data);
+    printf("INSERT breakdown (ns/op) search: %f, update: %f, clflush: %f\n",
+           (double)tsc_to_ns(d[STAT_SEARCH_CYCLES]) / num_data,
+           (double)tsc_to_ns(d[STAT_UPDATE_CYCLES]) / num_data,
+           (double)tsc_to_ns(d[STAT_FLUSH_CYCLES]) / num_data);
+    print_stats("INSERT", d);
   }
 
   clear_cache();
@@ -98,8 +110,10 @@ int main(int argc, char **argv) {
            (double)elapsed_time / num_data);
   }
 
+  flush_trace::report(stdout); // empty unless built with TRACE=1
+
   delete bt;
-  delete[] keys;
+  free_keys(keys, &input);
 
   return 0;
 }
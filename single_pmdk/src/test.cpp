@@ -1,4 +1,5 @@
 #include "btree.h"
+#include "../../bench/trace.h"
 
 /*
  *file_exists -- checks if file exists
@@ -16,18 +17,28 @@ void clear_cache() {
   delete[] garbage;
 }
 
+// print the event counts of d, leaving out the cycle counters, which stay
+// zero on a pool
+void print_stats(const char *phase, const btree_stats &d) {
+  printf("%s stats:", phase);
+  for (int i = 0; i < STAT_SEARCH_CYCLES; ++i)
+    printf(" %s %llu", stats::name(i), d[i]);
+  printf("\n");
+}
+
 // MAIN
 int main(int argc, char **argv) {
   // Parsing arguments
   int num_data = 0;
   int n_threads = 1;
   float selection_ratio = 0.0f;
-  char *input_path = (char *)std::string("../sample_input.txt").data();
+  const char *input_path = "../sample_input.txt";
   char *persistent_path;
+  bool hybrid = false, reserve = false;
 
   srand(time(NULL));
   int c;
-  while ((c = getopt(argc, argv, "n:w:t:s:i:p:")) != -1) {
+  while ((c = getopt(argc, argv, "n:w:t:s:i:p:dR")) != -1) {
     switch (c) {
     case 'n':
       num_data = atoi(optarg);
@@ -35,10 +46,18 @@ int main(int argc, char **argv) {
     case 't':
       n_threads = atoi(optarg);
       break;
+    case 'd':
+      hybrid = true; // internal nodes in DRAM
+      break;
+    case 'R':
+      reserve = true; // split pages reserved on a background thread
+      break;
     case 's':
       selection_ratio = atof(optarg);
+      break;
     case 'i':
       input_path = optarg;
+      break;
     case 'p':
       persistent_path = optarg;
     default:
@@ -55,34 +74,31 @@ int main(int argc, char **argv) {
     pop = pmemobj_create(persistent_path, "btree", 8000000000,
                          0666); // make 1GB memory pool
     bt = POBJ_ROOT(pop, btree);
-    D_RW(bt)->constructor(pop);
+    D_RW(bt)->constructor(pop, hybrid);
   } else {
     pop = pmemobj_open(persistent_path, "btree");
     bt = POBJ_ROOT(pop, btree);
+    D_RW(bt)->open(pop, n_threads);
   }
+  if (reserve)
+    D_RW(bt)->start_reserver();
 
   struct timespec start, end;
 
-  // Reading data
-  entry_key_t *keys = new entry_key_t[num_data];
+  // Reading data: a binary trace is mapped, a text file is parsed
+  trace input;
+  long num_keys = num_data;
+  entry_key_t *keys = load_keys(input_path, &num_keys, &input);
   entry_key_t *query = new entry_key_t[2000];
   unsigned long *bufs = new unsigned long[num_data];
 
-  ifstream ifs;
-  ifs.open(input_path);
-  if (!ifs) {
+  if (!keys) {
     cout << "input loading error!" << endl;
-
-    delete[] keys;
     exit(-1);
   }
+  num_data = num_keys;
 
-  for (int i = 0; i < num_data; ++i) {
-    ifs >> keys[i];
-  }
-
-  ifs.close();
-
+  ifstream ifs;
   ifs.open("../workload/number1.txt");
   if (!ifs) {
     cout << "query loading error!" << endl;
@@ -98,6 +114,7 @@ int main(int argc, char **argv) {
   ifs.close();
 
   {
+    btree_stats before = stats::snapshot();
     clock_gettime(CLOCK_MONOTONIC, &start);
 
     for (int i = 0; i < num_data; ++i) {
@@ -112,6 +129,7 @@ int main(int argc, char **argv) {
 
     printf("INSERT elapsed_time: %ld, Avg: %f\n", elapsed_time,
            (double)elapsed_time / num_data);
+    print_stats("INSERT", stats::snapshot() - before);
     //    D_RW(bt)->printAll();
   }
   int Dead = 0;
@@ -166,10 +184,13 @@ int main(int argc, char **argv) {
            (double)elapsed_time / num_data);
   }
 
-  delete[] keys;
+  flush_trace::report(stdout); // empty unless built with TRACE=1
+
+  free_keys(keys, &input);
   delete[] query;
   delete[] bufs;
 
+  D_RW(bt)->stop_reserver();
   pmemobj_close(pop);
   return 0;
 }